@@ -0,0 +1,418 @@
+/*
+    Copyright (C) 2014  Povilas Kanapickas <povilas@radix.lt>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*  cfconv - converts a binary file of floats or doubles to text.
+
+    The input is memory-mapped. The values are formatted in blocks, each block
+    into a separate buffer, optionally by several threads in parallel. The
+    buffers are written to the output in order with plain write calls.
+
+    usage: cfconv [options] input [output]
+
+    -t f32|f64      type of the values (default f64)
+    -e le|be        byte order of the input (default le)
+    -f spec         printf conversion, e.g. %.17g (default %.17g)
+    -c n            number of values per line (default 1)
+    -d delim        delimiter between the values of a line (default ' ')
+    -j n            number of threads (default 1)
+    -p              format with snprintf instead of cformat
+    -s              print throughput statistics to stderr
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cformat.h"
+
+// Number of values each thread formats per round
+static const size_t BLOCK_VALUES = 1 << 18;
+static const size_t BUF_ALIGN = 64;
+// Limit of the width, the precision and the delimiter length
+static const int MAX_PARAM = 1024;
+// Space reserved in the buffer for each value with its delimiter. %f of the
+// largest double has 309 integer digits.
+static const size_t MAX_VALUE_LEN = 4096;
+
+struct Options {
+    bool is_float;
+    bool big_endian;
+    const char* spec;
+    unsigned columns;
+    std::string delim;
+    unsigned threads;
+    bool use_printf;
+    bool stats;
+    const char* input;
+    const char* output;
+
+    // parsed from spec
+    unsigned flags;
+    int width;
+    int prec;
+};
+
+static void usage()
+{
+    std::fprintf(stderr,
+        "usage: cfconv [options] input [output]\n"
+        "  -t f32|f64   type of the values (default f64)\n"
+        "  -e le|be     byte order of the input (default le)\n"
+        "  -f spec      printf conversion, e.g. %%.17g (default %%.17g)\n"
+        "  -c n         number of values per line (default 1)\n"
+        "  -d delim     delimiter between the values of a line (default ' ')\n"
+        "  -j n         number of threads (default 1)\n"
+        "  -p           format with snprintf instead of cformat\n"
+        "  -s           print throughput statistics to stderr\n");
+}
+
+/** Parses a printf conversion of the form %[flags][width][.prec]conv where
+    conv is one of eEfFgGaA. Returns false if the spec is not of that form.
+*/
+static bool parse_spec(const char* spec, unsigned& flags, int& width,
+                       int& prec)
+{
+    const char* p = spec;
+    if (*p++ != '%') {
+        return false;
+    }
+    flags = FLAG_NONE;
+    for (;; ++p) {
+        if (*p == '-') {
+            flags |= FLAG_LEFT;
+        } else if (*p == '+') {
+            flags |= FLAG_SIGN;
+        } else if (*p == ' ') {
+            flags |= FLAG_SPACE;
+        } else if (*p == '0') {
+            flags |= FLAG_ZERO;
+        } else if (*p == '#') {
+            flags |= FLAG_ALT;
+        } else {
+            break;
+        }
+    }
+    width = -1;
+    if (*p >= '1' && *p <= '9') {
+        width = std::strtol(p, const_cast<char**>(&p), 10);
+        if (width > MAX_PARAM) {
+            return false;
+        }
+    }
+    prec = -1;
+    if (*p == '.') {
+        ++p;
+        prec = std::strtol(p, const_cast<char**>(&p), 10);
+        if (prec > MAX_PARAM) {
+            return false;
+        }
+    }
+    char conv = *p++;
+    if (*p != '\0') {
+        return false;
+    }
+    if (conv >= 'A' && conv <= 'Z') {
+        flags |= FLAG_UPPERCASE;
+        conv += 'a' - 'A';
+    }
+    switch (conv) {
+    case 'e': flags |= FLAG_FLT_EXP; break;
+    case 'f': flags |= FLAG_FLT_NOR; break;
+    case 'g': break;
+    case 'a': flags |= FLAG_FLT_HEX; break;
+    default: return false;
+    }
+    return true;
+}
+
+static bool parse_options(int argc, char** argv, Options& opt)
+{
+    opt.is_float = false;
+    opt.big_endian = false;
+    opt.spec = "%.17g";
+    opt.columns = 1;
+    opt.delim = " ";
+    opt.threads = 1;
+    opt.use_printf = false;
+    opt.stats = false;
+    opt.input = NULL;
+    opt.output = NULL;
+
+    int c;
+    while ((c = getopt(argc, argv, "t:e:f:c:d:j:ps")) != -1) {
+        switch (c) {
+        case 't':
+            if (std::strcmp(optarg, "f32") == 0) {
+                opt.is_float = true;
+            } else if (std::strcmp(optarg, "f64") != 0) {
+                return false;
+            }
+            break;
+        case 'e':
+            if (std::strcmp(optarg, "be") == 0) {
+                opt.big_endian = true;
+            } else if (std::strcmp(optarg, "le") != 0) {
+                return false;
+            }
+            break;
+        case 'f': opt.spec = optarg; break;
+        case 'c': opt.columns = std::max(1, std::atoi(optarg)); break;
+        case 'd': opt.delim = optarg; break;
+        case 'j': opt.threads = std::max(1, std::atoi(optarg)); break;
+        case 'p': opt.use_printf = true; break;
+        case 's': opt.stats = true; break;
+        default: return false;
+        }
+    }
+    if (optind >= argc || argc - optind > 2) {
+        return false;
+    }
+    opt.input = argv[optind];
+    if (argc - optind == 2) {
+        opt.output = argv[optind + 1];
+    }
+    if (opt.delim.size() > size_t(MAX_PARAM)) {
+        return false;
+    }
+    if (!parse_spec(opt.spec, opt.flags, opt.width, opt.prec)) {
+        std::fprintf(stderr, "cfconv: unsupported conversion '%s'\n", opt.spec);
+        return false;
+    }
+    return true;
+}
+
+/// Growable output buffer aligned to BUF_ALIGN
+struct OutBuffer {
+    char* data;
+    size_t size;
+    size_t capacity;
+
+    OutBuffer() : data(NULL), size(0), capacity(0) {}
+    ~OutBuffer() { std::free(data); }
+
+    void reserve(size_t n)
+    {
+        if (capacity - size >= n) {
+            return;
+        }
+        size_t new_cap = std::max(capacity * 2, size + n);
+        new_cap = (new_cap + BUF_ALIGN - 1) & ~(BUF_ALIGN - 1);
+        char* new_data = (char*) std::aligned_alloc(BUF_ALIGN, new_cap);
+        if (!new_data) {
+            std::fprintf(stderr, "cfconv: out of memory\n");
+            std::exit(1);
+        }
+        std::memcpy(new_data, data, size);
+        std::free(data);
+        data = new_data;
+        capacity = new_cap;
+    }
+};
+
+inline float load_value(const char* p, bool swap, float)
+{
+    uint32_t bits;
+    std::memcpy(&bits, p, sizeof(bits));
+    if (swap) {
+        bits = __builtin_bswap32(bits);
+    }
+    float val;
+    std::memcpy(&val, &bits, sizeof(val));
+    return val;
+}
+
+inline double load_value(const char* p, bool swap, double)
+{
+    uint64_t bits;
+    std::memcpy(&bits, p, sizeof(bits));
+    if (swap) {
+        bits = __builtin_bswap64(bits);
+    }
+    double val;
+    std::memcpy(&val, &bits, sizeof(val));
+    return val;
+}
+
+/** Formats the values [first, last) of the input into buf. The delimiters
+    depend on the position of the value in the whole file of @a count values.
+*/
+template<class T>
+void format_block(const Options& opt, const char* input, size_t count,
+                  size_t first, size_t last, OutBuffer& buf)
+{
+    static const FmtInfo fmt = { '.', '\'', NULL, 0 };
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    bool swap = !opt.big_endian;
+#else
+    bool swap = opt.big_endian;
+#endif
+    buf.size = 0;
+    buf.reserve((last - first) * 24);
+    for (size_t i = first; i < last; ++i) {
+        T val = load_value(input + i * sizeof(T), swap, T());
+        buf.reserve(MAX_VALUE_LEN);
+        char* out = buf.data + buf.size;
+        char* out_last = buf.data + buf.capacity;
+        if (opt.use_printf) {
+            int n = std::snprintf(out, out_last - out, opt.spec, val);
+            out += std::max(n, 0);
+        } else {
+            out = print_float10(out, out_last, opt.flags, opt.width, opt.prec,
+                                fmt, val, opt.spec);
+        }
+        if ((i + 1) % opt.columns == 0 || i + 1 == count) {
+            *out++ = '\n';
+        } else {
+            out = std::copy(opt.delim.begin(), opt.delim.end(), out);
+        }
+        buf.size = out - buf.data;
+    }
+}
+
+static bool write_all(int fd, const char* data, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0) {
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+template<class T>
+bool convert(const Options& opt, const char* input, size_t count, int out_fd,
+             size_t& out_bytes)
+{
+    std::vector<OutBuffer> bufs(opt.threads);
+    std::vector<std::thread> workers;
+    out_bytes = 0;
+
+    for (size_t base = 0; base < count; base += BLOCK_VALUES * opt.threads) {
+        size_t end = std::min(count, base + BLOCK_VALUES * opt.threads);
+        workers.clear();
+        for (unsigned t = 1; t < opt.threads; ++t) {
+            size_t first = std::min(end, base + t * BLOCK_VALUES);
+            size_t last = std::min(end, first + BLOCK_VALUES);
+            workers.push_back(std::thread(format_block<T>, std::cref(opt),
+                                          input, count, first, last,
+                                          std::ref(bufs[t])));
+        }
+        format_block<T>(opt, input, count, base,
+                        std::min(end, base + BLOCK_VALUES), bufs[0]);
+        for (unsigned t = 0; t < workers.size(); ++t) {
+            workers[t].join();
+        }
+
+        for (unsigned t = 0; t < opt.threads; ++t) {
+            if (!write_all(out_fd, bufs[t].data, bufs[t].size)) {
+                return false;
+            }
+            out_bytes += bufs[t].size;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    if (!parse_options(argc, argv, opt)) {
+        usage();
+        return 2;
+    }
+
+    int in_fd = ::open(opt.input, O_RDONLY);
+    if (in_fd < 0) {
+        std::perror(opt.input);
+        return 1;
+    }
+    struct stat st;
+    if (::fstat(in_fd, &st) < 0) {
+        std::perror(opt.input);
+        return 1;
+    }
+    size_t elem_size = opt.is_float ? sizeof(float) : sizeof(double);
+    size_t in_size = st.st_size;
+    if (in_size % elem_size != 0) {
+        std::fprintf(stderr, "cfconv: %s: size is not a multiple of %u, "
+                     "the trailing bytes are ignored\n", opt.input,
+                     unsigned(elem_size));
+    }
+    size_t count = in_size / elem_size;
+
+    const char* input = NULL;
+    if (in_size > 0) {
+        void* map = ::mmap(NULL, in_size, PROT_READ, MAP_PRIVATE, in_fd, 0);
+        if (map == MAP_FAILED) {
+            std::perror(opt.input);
+            return 1;
+        }
+        ::madvise(map, in_size, MADV_SEQUENTIAL);
+        input = (const char*) map;
+    }
+
+    int out_fd = STDOUT_FILENO;
+    if (opt.output) {
+        out_fd = ::open(opt.output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out_fd < 0) {
+            std::perror(opt.output);
+            return 1;
+        }
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    size_t out_bytes;
+    bool ok = opt.is_float ?
+            convert<float>(opt, input, count, out_fd, out_bytes) :
+            convert<double>(opt, input, count, out_fd, out_bytes);
+    if (!ok) {
+        std::perror(opt.output ? opt.output : "stdout");
+        return 1;
+    }
+    if (opt.output && ::close(out_fd) < 0) {
+        std::perror(opt.output);
+        return 1;
+    }
+    double secs = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+
+    if (opt.stats) {
+        std::fprintf(stderr, "%zu values in %.3f s: input %.3f GB/s, "
+                     "output %.3f GB/s, %.1f M values/s\n", count, secs,
+                     in_size / secs / 1e9, out_bytes / secs / 1e9,
+                     count / secs / 1e6);
+    }
+    if (input) {
+        ::munmap((void*) input, in_size);
+    }
+    ::close(in_fd);
+    return 0;
+}
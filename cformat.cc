@@ -16,808 +16,1133 @@
 */
 
 #include <algorithm>
+#include <memory>
 #include <string>
-#include <stdexcept>
 #include <cstring>
 #include <iostream>
 #include <cstdio>
+#include <cmath>
 #include <stdint.h>
 
 #include "cformat.h"
+#include "cformat_impl.h"
 
-inline void fill_impl(std::ostream& out, unsigned count,
-                      const char* spbuf, unsigned spbuf_len)
+using namespace cformat_detail;
+
+/*  The float and double overloads of print_float10 are never inlined by
+    default. Define CF_ALLOW_INLINE to leave the decision to the compiler, so
+    that with -flto they can be inlined into callers in other translation
+    units. See also cformat_inline.h.
+*/
+#if CF_ALLOW_INLINE
+#define CF_NOINLINE
+#else
+#define CF_NOINLINE __attribute__((noinline))
+#endif
+
+float to_float(Float16 val)
 {
-    while (count > 0) {
-        out.write(spbuf, spbuf_len);
-        count -= spbuf_len;
-    }
+    return half_to_float(val);
 }
 
-static const char* fill_spaces_spbuf =
-        "                                        "
-        "                                        "
-        "                                        "
-        "                                        "
-        "                                        ";
-
-static const char* fill_zeros_spbuf =
-        "0000000000000000000000000000000000000000"
-        "0000000000000000000000000000000000000000"
-        "0000000000000000000000000000000000000000"
-        "0000000000000000000000000000000000000000"
-        "0000000000000000000000000000000000000000";
+float to_float(BFloat16 val)
+{
+    return half_to_float(val);
+}
 
-inline char* fill_spaces(std::ostream& out, unsigned count)
+void CF_NOINLINE
+     print_float10(std::ostream& ostr, unsigned flags, int width,
+                        int prec, const FmtInfo& fmt, float val, const char* fallback)
 {
-    fill_impl(out, count, fill_spaces_spbuf, 200);
+    StreamSink sink(ostr);
+    print_float10_sink(sink, flags, width, prec, fmt, val, fallback);
 }
 
-inline char* fill_zeros(std::ostream& out, unsigned count)
+void CF_NOINLINE
+     print_float10(std::ostream& ostr, unsigned flags, int width,
+                   int prec, const FmtInfo& fmt, double val, const char* fallback)
 {
-    fill_impl(out, count, fill_zeros_spbuf, 200);
+    StreamSink sink(ostr);
+    print_float10_sink(sink, flags, width, prec, fmt, val, fallback);
 }
 
-enum FloatFlags {
-    FLOAT_NONE = 0,
-    FLOAT_NEG = 1 << 0,         // negative
-    FLOAT_NAN = 1 << 1,         // not a number
-    FLOAT_INF = 1 << 2,         // positive or negative infinity
-};
+char* CF_NOINLINE
+      print_float10(char* first, char* last, unsigned flags, int width,
+                    int prec, const FmtInfo& fmt, float val, const char* fallback)
+{
+    return print_float10_buf(first, last, flags, width, prec, fmt, val, fallback);
+}
 
-#define USE_INT128 0
+char* CF_NOINLINE
+      print_float10(char* first, char* last, unsigned flags, int width,
+                    int prec, const FmtInfo& fmt, double val, const char* fallback)
+{
+    return print_float10_buf(first, last, flags, width, prec, fmt, val, fallback);
+}
 
-struct Uint96 {
-    uint64_t hi;
-    uint32_t lo;
-};
+void print_float10(std::ostream& ostr, unsigned flags, int width, int prec,
+                   const FmtInfo& fmt, Float16 val, const char* fallback)
+{
+    StreamSink sink(ostr);
+    print_float10_sink(sink, flags, width, prec, fmt, val, fallback);
+}
 
-// Division is performed by multiplication.
+void print_float10(std::ostream& ostr, unsigned flags, int width, int prec,
+                   const FmtInfo& fmt, BFloat16 val, const char* fallback)
+{
+    StreamSink sink(ostr);
+    print_float10_sink(sink, flags, width, prec, fmt, val, fallback);
+}
 
-#if USE_INT128
-inline uint64_t mulhi(uint64_t a, uint64_t b)
+char* print_float10(char* first, char* last, unsigned flags, int width,
+                    int prec, const FmtInfo& fmt, Float16 val, const char* fallback)
 {
-    return ((unsigned __int128)(a) * b) >> 64;
+    return print_float10_buf(first, last, flags, width, prec, fmt, val, fallback);
 }
-#else
-inline uint64_t mulhi(uint64_t a, uint64_t b)
+
+char* print_float10(char* first, char* last, unsigned flags, int width,
+                    int prec, const FmtInfo& fmt, BFloat16 val, const char* fallback)
 {
-    uint32_t ah, al, bh, bl;
-    ah = a >> 32;
-    al = a & 0xffffffff;
-    bh = b >> 32;
-    bl = b & 0xffffffff;
-    uint64_t r;
-    //uint32_t l;
+    return print_float10_buf(first, last, flags, width, prec, fmt, val, fallback);
+}
 
-    r = uint64_t(ah) * bh;
-    r += (uint64_t(bh) * al) >> 32;
-    r += (uint64_t(bl) * ah) >> 32;
-    return r;
+/// Returns the FmtInfo to pass to the formatter for a wide FmtInfo
+template<class CharT>
+inline FmtInfo narrow_fmt(const BasicFmtInfo<CharT>& fmt)
+{
+    FmtInfo res;
+    res.dot = (fmt.dot > 0 && fmt.dot < 0x80) ? char(fmt.dot) : WIDE_DOT_PLACEHOLDER;
+    res.sep = (fmt.sep > 0 && fmt.sep < 0x80) ? char(fmt.sep) : '\'';
+    res.groups = fmt.groups;
+    res.grouplen = fmt.grouplen;
+    return res;
 }
-#endif
 
-#if USE_INT128
-inline Uint96 mulhi(Uint96 a, Uint96 b)
+template<class CharT, class T>
+inline void print_float10_wide(std::basic_ostream<CharT>& ostr, unsigned flags,
+                               int width, int prec,
+                               const BasicFmtInfo<CharT>& fmt, T val,
+                               const char* fallback)
 {
-    uint64_t rh, rl;
-    rh = ((unsigned __int128)(a.hi) * b.hi) >> 64;
-    rl = ((unsigned __int128)(a.hi) * b.hi);
+    WideStreamSink<CharT> sink(ostr, fmt.dot);
+    print_float10_sink(sink, flags, width, prec, narrow_fmt(fmt), val, fallback);
+}
 
-    uint64_t ah32, bh32;
-    ah32 = a.hi >> 32;
-    bh32 = b.hi >> 32;
-    rl += (uint64_t(ah32) * b.lo);
-    rl += (uint64_t(bh32) * a.lo);
-    rl >>= 32;
-    a.hi = rh;
-    a.lo = rl;
+template<class CharT, class T>
+inline CharT* print_float10_wide(CharT* first, CharT* last, unsigned flags,
+                                 int width, int prec,
+                                 const BasicFmtInfo<CharT>& fmt, T val,
+                                 const char* fallback)
+{
+    WideBufferSink<CharT> sink(first, last, fmt.dot);
+    print_float10_sink(sink, flags, width, prec, narrow_fmt(fmt), val, fallback);
+    return sink.overflow ? NULL : sink.out;
 }
-#else
-inline Uint96 mulhi(Uint96 a, Uint96 b)
-{
-    /*        a1a2a3
-            * b1b2b3
-        r1r2r3
-        a1b1
-          a1b2
-            a1b3
-          a2b1
-            a2b2
-            a3b1
-
-    */
-    uint32_t a1, a2, a3;
-    uint32_t b1, b2, b3;
-    a1 = a.hi >> 32;
-    a2 = a.hi & 0xffffffff;
-    a3 = a.lo;
-    b1 = b.hi >> 32;
-    b2 = b.hi & 0xffffffff;
-    b3 = b.lo;
-    uint64_t rh, rl, i1, i2;
-    rh = uint64_t(a1) * b1;
-    i1 = uint64_t(a1) * b2;
-    i2 = uint64_t(a2) * b1;
-    rh += i1 >> 32;
-    rh += i2 >> 32;
-    rl = i1 & 0xffffffff;
-    rl += i2 & 0xffffffff;
-    rl += (uint64_t(a1) * b3) >> 32;
-    rl += (uint64_t(a2) * b2) >> 32;
-    rl += (uint64_t(a3) * b1) >> 32;
-    rh += rl >> 32;
-    rl &= 0xffffffff;
-    a.hi = rh;
-    a.lo = rl;
-    return a;
+
+template<class CharT>
+void print_float10(std::basic_ostream<CharT>& ostr, unsigned flags, int width,
+                   int prec, const BasicFmtInfo<CharT>& fmt, float val,
+                   const char* fallback)
+{
+    print_float10_wide(ostr, flags, width, prec, fmt, val, fallback);
 }
-#endif
 
-struct DivDesc {
-    unsigned exp2;
-    unsigned exp5;
-    uint64_t cf1;
-    uint32_t cf2;
-};
+template<class CharT>
+void print_float10(std::basic_ostream<CharT>& ostr, unsigned flags, int width,
+                   int prec, const BasicFmtInfo<CharT>& fmt, double val,
+                   const char* fallback)
+{
+    print_float10_wide(ostr, flags, width, prec, fmt, val, fallback);
+}
 
-inline uint64_t muldiv(uint64_t d, const DivDesc& desc)
+template<class CharT>
+CharT* print_float10(CharT* first, CharT* last, unsigned flags, int width,
+                     int prec, const BasicFmtInfo<CharT>& fmt, float val,
+                     const char* fallback)
 {
-    return mulhi(d, desc.cf1);
+    return print_float10_wide(first, last, flags, width, prec, fmt, val,
+                              fallback);
 }
-inline Uint96 muldiv(Uint96 d, const DivDesc& desc)
+
+template<class CharT>
+CharT* print_float10(CharT* first, CharT* last, unsigned flags, int width,
+                     int prec, const BasicFmtInfo<CharT>& fmt, double val,
+                     const char* fallback)
 {
-    Uint96 c; c.hi = desc.cf1; c.lo = desc.cf2;
-    return mulhi(d, c);
+    return print_float10_wide(first, last, flags, width, prec, fmt, val,
+                              fallback);
 }
 
-inline uint64_t mul(uint64_t d, unsigned i)
+#define CF_INSTANTIATE_WIDE(CharT)                                             \
+    template void print_float10(std::basic_ostream<CharT>&, unsigned, int, int, \
+                                const BasicFmtInfo<CharT>&, float, const char*);\
+    template void print_float10(std::basic_ostream<CharT>&, unsigned, int, int, \
+                                const BasicFmtInfo<CharT>&, double, const char*);\
+    template CharT* print_float10(CharT*, CharT*, unsigned, int, int,           \
+                                  const BasicFmtInfo<CharT>&, float, const char*);\
+    template CharT* print_float10(CharT*, CharT*, unsigned, int, int,           \
+                                  const BasicFmtInfo<CharT>&, double, const char*);
+
+CF_INSTANTIATE_WIDE(wchar_t)
+CF_INSTANTIATE_WIDE(char16_t)
+CF_INSTANTIATE_WIDE(char32_t)
+#ifdef __cpp_char8_t
+CF_INSTANTIATE_WIDE(char8_t)
+#endif
+
+#undef CF_INSTANTIATE_WIDE
+
+template<class T>
+inline char* print_float10_batch_impl(char* first, char* last, unsigned flags,
+                                      int width, int prec, const FmtInfo& fmt,
+                                      const T* vals, unsigned count, char sep,
+                                      const char* fallback, FormatCache* cache)
 {
-    return d*i;
+    for (unsigned i = 0; i < count; ++i) {
+        if (cache) {
+            first = cache->print(first, last, flags, width, prec, fmt, vals[i],
+                                 fallback);
+        } else {
+            first = print_float10_buf(first, last, flags, width, prec, fmt,
+                                      vals[i], fallback);
+        }
+        if (first == NULL || first == last) {
+            return NULL;
+        }
+        *first++ = sep;
+    }
+    return first;
 }
 
-inline Uint96 mul(Uint96 d, unsigned i)
+char* print_float10_batch(char* first, char* last, unsigned flags, int width,
+                          int prec, const FmtInfo& fmt, const float* vals,
+                          unsigned count, char sep, const char* fallback,
+                          FormatCache* cache)
 {
-    uint64_t rl, rh;
-    rl = uint64_t(d.lo) * i;
-    rh = d.hi * i;
-    rh += rl >> 32;
-    rl &= 0xffffffff;
-    d.hi = rh;
-    d.lo = rl;
-    return d;
+    return print_float10_batch_impl(first, last, flags, width, prec, fmt,
+                                    vals, count, sep, fallback, cache);
 }
 
-const DivDesc mul2div5_desc[] = { //FIXME: not tuned, i.e. more entries needed
-    {202, 87, 0xfea126b7d78186bc, 0xe2f610c8 },
-    { 65, 28, 0xfd87b5f28300ca0d, 0x8bca9d6e },
-    { 23, 10, 0xdbe6fecebdedd5be, 0xb573440e },
-    {  6,  3, 0x83126e978d4fdf3b, 0x645a1cac },
-    {  2,  1, 0xcccccccccccccccc, 0xcccccccc },
-};
+char* print_float10_batch(char* first, char* last, unsigned flags, int width,
+                          int prec, const FmtInfo& fmt, const double* vals,
+                          unsigned count, char sep, const char* fallback,
+                          FormatCache* cache)
+{
+    return print_float10_batch_impl(first, last, flags, width, prec, fmt,
+                                    vals, count, sep, fallback, cache);
+}
 
-const DivDesc mul5div2_desc[] = { //FIXME: not tuned, i.e. more entries needed
-    {209, 90, 0xfb5878494ace3a5f, 0x04ab48a0 },
-    { 72, 31, 0xfc6f7c4045812296, 0x4d000000 },
-    { 28, 12, 0xe8d4a51000000000, 0x00000000 },
-    { 14,  6, 0xf424000000000000, 0x00000000 },
-    {  7,  3, 0xfa00000000000000, 0x00000000 },
-    {  3,  1, 0xa000000000000000, 0x00000000 }
-};
+template<class T>
+inline char* print_float10_batch16(char* first, char* last, unsigned flags,
+                                   int width, int prec, const FmtInfo& fmt,
+                                   const T* vals, unsigned count, char sep,
+                                   const char* fallback)
+{
+    for (unsigned i = 0; i < count; ++i) {
+        first = print_float10_buf(first, last, flags, width, prec, fmt,
+                                  vals[i], fallback);
+        if (first == NULL || first == last) {
+            return NULL;
+        }
+        *first++ = sep;
+    }
+    return first;
+}
 
-// shift - at most 32 bits
-inline uint64_t shift_r(uint64_t d, unsigned i) { return d >> i; }
-inline uint64_t shift_l(uint64_t d, unsigned i) { return d << i; }
-inline Uint96 shift_r(Uint96 d, unsigned i)
+char* print_float10_batch(char* first, char* last, unsigned flags, int width,
+                          int prec, const FmtInfo& fmt, const Float16* vals,
+                          unsigned count, char sep, const char* fallback)
 {
-    d.lo >>= i;
-    d.lo |= uint32_t(d.hi & 0xffffffff) << 32-i;
-    d.hi >>= i;
-    return d;
+    return print_float10_batch16(first, last, flags, width, prec, fmt, vals,
+                                 count, sep, fallback);
 }
-inline Uint96 shift_l(Uint96 d, unsigned i)
+
+char* print_float10_batch(char* first, char* last, unsigned flags, int width,
+                          int prec, const FmtInfo& fmt, const BFloat16* vals,
+                          unsigned count, char sep, const char* fallback)
 {
-    d.hi <<= i;
-    d.hi |= d.lo >> 32-i;
-    d.lo <<= i;
-    return d;
+    return print_float10_batch16(first, last, flags, width, prec, fmt, vals,
+                                 count, sep, fallback);
 }
 
-/*  IEEE754 32-bit float
-    1 bit: sign
-    8 bits: exponent
-    23 bits: significand (24th bit is implicitly set, but only if the number is
-        not denormal
+/// Sink that only counts the characters
+struct CountSink {
+    unsigned count;
 
-    IEEE754 64-bit float
-    1 bit: sign
-    11 bits: exponent
-    52 bits: significand (53th bit is implicitly set, but only if the number is
-        not denormal
+    CountSink() : count(0) {}
 
-    The function sets @a signif and @a exp only if the number not infinity or
-    NaN.
+    void put(char)                    { count++; }
+    void write(const char*, unsigned n) { count += n; }
+    void fill_spaces(unsigned n)      { count += n; }
+    void fill_zeros(unsigned n)       { count += n; }
+};
 
-    Significand is set in such a way that the (implicit) MSB of the significand
-    is shifted to the most significand position of signif.
-*/
-void decompose(float f, unsigned& fltflags, uint64_t& signif, int& exp)
+/// Returns 10^k as a double. The result is exact up to 10^19.
+inline double pow10_double(int k)
 {
-    uint32_t fi;
-    std::memcpy(&fi, &f, sizeof(f));
-    fltflags = ((fi >> 31) == 1) ? FLOAT_NEG : FLOAT_NONE;
-    fi &= 0x7fffffff;
-    if (fi == 0x7fffffff) {
-        fltflags |= FLOAT_INF;
-        return;
+    if (k >= 0 && k < int(sizeof(pow10_table) / sizeof(*pow10_table))) {
+        return double(pow10_table[k]);
     }
-    exp = fi >> 24;
-    if (exp == 0xff) {
-        fltflags |= FLOAT_NAN;
-        return;
-    }
-    signif = ((uint64_t) (fi | 0x00800000)) << 8+32;
-    exp -= 127;
+    return std::pow(10.0, k);
 }
 
-void decompose(double f, unsigned& fltflags, Uint96& signif, int& exp)
+/// Returns true if it can't be decided from the double values whether a < b
+inline bool is_close(double a, double b)
 {
-    uint64_t fi;
-    std::memcpy(&fi, &f, sizeof(f));
-    fltflags = ((fi >> 63) == 1) ? FLOAT_NEG : FLOAT_NONE;
-    fi &= 0x7fffffffffffffff;
-    if (fi == 0x7fffffffffffffff) {
-        fltflags |= FLOAT_INF;
-        return;
+    return std::fabs(a - b) <= b * 0x1p-50;
+}
+
+/** The parameters of a column that do not depend on the values. A value has
+    k+1 integer digits in %f if it is at least 10^k - half_ulp, i.e. rounds to
+    at least 10^k. A value has a three-digit exponent in %e if it is at least
+    exp3_max or less than exp3_min.
+*/
+struct MatrixColumn {
+    unsigned flags;
+    int prec;
+    unsigned frac_len;      // the dot and the fraction digits
+    double half_ulp;
+    double exp3_max;
+    double exp3_min;
+    char fallback[40];      // without width, for measuring
+
+    void init(const ColumnSpec& spec)
+    {
+        flags = spec.flags;
+        prec = spec.prec;
+        int p = (prec < 0) ? 6 : prec;
+        frac_len = (p > 0 || (flags & FLAG_ALT)) ? p + 1 : 0;
+        half_ulp = 0.5 * pow10_double(-p);
+        exp3_max = 1e100 * (1 - 0.05 * pow10_double(-p));
+        exp3_min = 1e-99 * (1 - 0.05 * pow10_double(-p));
+        make_printf_fmt(fallback, sizeof(fallback), flags, -1, prec);
     }
-    exp = fi >> 52;
-    if (exp == 0xfff) {
-        fltflags |= FLOAT_NAN;
-        return;
+};
+
+/// Returns the length of @a val formatted as specified by @a col
+template<class T>
+unsigned matrix_cell_length(const MatrixColumn& col, const FmtInfo& fmt, T val)
+{
+    unsigned fltflags;
+    typename FloatTraits<T>::Signif signif;
+    int exp;
+    decompose(val, fltflags, signif, exp);
+
+    unsigned len = 0;
+    if ((fltflags & FLOAT_NEG) || (col.flags & (FLAG_SIGN | FLAG_SPACE))) {
+        len = 1;
+    }
+    if (fltflags & (FLOAT_NAN | FLOAT_INF)) {
+        return len + 3;
+    }
+
+    double abs_val = std::fabs(double(val));
+    if (col.flags & FLAG_FLT_NOR) {
+        unsigned int_digits = 1;
+        if (!(fltflags & FLOAT_ZERO) && exp >= 0) {
+            // 10^k <= 2^exp <= val for k = floor(log10(2) * exp)
+            int_digits = ((exp * 78913) >> 18) + 1;
+            for (;;) {
+                double next = pow10_double(int_digits) - col.half_ulp;
+                if (is_close(abs_val, next)) {
+                    goto format;
+                }
+                if (abs_val < next) {
+                    break;
+                }
+                int_digits++;
+            }
+        }
+        return len + int_digits + col.frac_len;
     }
-    signif.hi = (fi | 0x0010000000000000) << 11;
-    signif.lo = 0;
-    exp -= 1023;
+    if (col.flags & FLAG_FLT_EXP) {
+        unsigned exp_digits = 2;
+        if (!(fltflags & FLOAT_ZERO)) {
+            if (exp > 320) {
+                if (is_close(abs_val, col.exp3_max)) {
+                    goto format;
+                }
+                exp_digits = (abs_val < col.exp3_max) ? 2 : 3;
+            } else if (exp < -320) {
+                if (is_close(abs_val, col.exp3_min)) {
+                    goto format;
+                }
+                exp_digits = (abs_val < col.exp3_min) ? 3 : 2;
+            }
+        }
+        // d.ddde+dd
+        return len + 1 + col.frac_len + 2 + exp_digits;
+    }
+
+format:
+    CountSink sink;
+    print_float10_sink(sink, col.flags, -1, col.prec, fmt, val, col.fallback);
+    return sink.count;
 }
 
-const char* get_special(unsigned fltflags, unsigned flags)
+template<class T>
+std::size_t matrix_column_widths_impl(const ColumnSpec* specs,
+                                      const FmtInfo& fmt, const T* vals,
+                                      unsigned rows, unsigned cols,
+                                      int* widths)
 {
-    if (fltflags & FLOAT_NAN) {
-        const char* sp;
-        if (flags & FLAG_UPPERCASE) {
-            return "NAN";
-        } else {
-            return "nan";
+    std::unique_ptr<MatrixColumn[]> columns(new MatrixColumn[cols]);
+    for (unsigned c = 0; c < cols; ++c) {
+        columns[c].init(specs[c]);
+        widths[c] = std::max(specs[c].width, 0);
+    }
+    for (unsigned r = 0; r < rows; ++r) {
+        const T* row = vals + std::size_t(r) * cols;
+        for (unsigned c = 0; c < cols; ++c) {
+            int len = matrix_cell_length(columns[c], fmt, row[c]);
+            widths[c] = std::max(widths[c], len);
         }
     }
-    if (flags & FLAG_UPPERCASE) {
-        return "INF";
-    } else {
-        return "inf";
+
+    // the separators and the newline
+    std::size_t row_len = cols;
+    for (unsigned c = 0; c < cols; ++c) {
+        row_len += widths[c];
     }
+    return row_len * rows;
 }
 
+std::size_t matrix_column_widths(const ColumnSpec* specs, const FmtInfo& fmt,
+                                 const float* vals, unsigned rows,
+                                 unsigned cols, int* widths)
+{
+    return matrix_column_widths_impl(specs, fmt, vals, rows, cols, widths);
+}
 
-
-/** We must keep as many significant digits in signif as possible at all times.
-    This function shifts signif by one position and updates the exponent in
-    case the msb of signif becomes zero.
-*/
-inline uint64_t renormalize_signif(uint64_t signif, int& exp)
+std::size_t matrix_column_widths(const ColumnSpec* specs, const FmtInfo& fmt,
+                                 const double* vals, unsigned rows,
+                                 unsigned cols, int* widths)
 {
-    if (exp > 0) {
-        unsigned shift = (signif >> 63) ^ 1; // shift iff the top 4 bits are
-        signif <<= shift;
-        exp -= shift;
-    }
-    return signif;
+    return matrix_column_widths_impl(specs, fmt, vals, rows, cols, widths);
 }
 
-inline Uint96 renormalize_signif(Uint96 signif, int& exp)
+template<class T>
+char* print_float10_matrix_impl(char* first, char* last,
+                                const ColumnSpec* specs, const int* widths,
+                                const FmtInfo& fmt, const T* vals,
+                                unsigned rows, unsigned cols, char sep)
 {
-    if (signif.hi & 0xf000000000000000 == 0) {
-        signif = shift_l(signif, 4);
-        exp -= 4;
+    // The fallback includes the width so that its output is padded as well
+    std::unique_ptr<char[][40]> fallbacks(new char[cols][40]);
+    for (unsigned c = 0; c < cols; ++c) {
+        make_printf_fmt(fallbacks[c], sizeof(fallbacks[c]), specs[c].flags,
+                        widths[c], specs[c].prec);
+    }
+    for (unsigned r = 0; r < rows; ++r) {
+        const T* row = vals + std::size_t(r) * cols;
+        for (unsigned c = 0; c < cols; ++c) {
+            first = print_float10_buf(first, last, specs[c].flags, widths[c],
+                                      specs[c].prec, fmt, row[c],
+                                      fallbacks[c]);
+            if (first == NULL || first == last) {
+                return NULL;
+            }
+            *first++ = (c + 1 == cols) ? '\n' : sep;
+        }
     }
-    return signif;
+    return first;
 }
 
-inline unsigned extract_signif_digit(uint64_t signif) { return signif >> 60; }
-inline uint64_t clear_signif_digit(uint64_t signif)   { return signif & ~0xf000000000000000; }
-inline unsigned extract_signif_digit(Uint96 signif) { return signif.hi >> 60; }
-inline Uint96 clear_signif_digit(Uint96 signif)     { signif.hi &= ~0xf000000000000000; return signif; }
-inline bool is_zero(uint64_t d) { return d == 0; }
-inline bool is_zero(Uint96 d) { return d.hi == 0 && d.lo == 0; }
+char* print_float10_matrix(char* first, char* last, const ColumnSpec* specs,
+                           const int* widths, const FmtInfo& fmt,
+                           const float* vals, unsigned rows, unsigned cols,
+                           char sep)
+{
+    return print_float10_matrix_impl(first, last, specs, widths, fmt, vals,
+                                     rows, cols, sep);
+}
 
+char* print_float10_matrix(char* first, char* last, const ColumnSpec* specs,
+                           const int* widths, const FmtInfo& fmt,
+                           const double* vals, unsigned rows, unsigned cols,
+                           char sep)
+{
+    return print_float10_matrix_impl(first, last, specs, widths, fmt, vals,
+                                     rows, cols, sep);
+}
 
-/// Extracts a digit and prepares the signif for next extraction
-template<class T>
-inline unsigned extract_update_signif_digit(T& signif)
+/// Writes @a key as a JSON string followed by a colon
+inline void write_json_key(BufferSink& sink, const char* key)
 {
-    unsigned res = extract_signif_digit(signif);
-    signif = clear_signif_digit(signif);
-    signif = mul(signif, 10);
-    return res;
+    sink.put('"');
+    // plain characters are copied in runs
+    const char* run = key;
+    for (; *key != '\0'; ++key) {
+        unsigned char c = *key;
+        if (c != '"' && c != '\\' && c >= 0x20) {
+            continue;
+        }
+        sink.write(run, key - run);
+        if (c < 0x20) {
+            char esc[6] = { '\\', 'u', '0', '0', "0123456789abcdef"[c >> 4],
+                            "0123456789abcdef"[c & 0xf] };
+            sink.write(esc, 6);
+        } else {
+            sink.put('\\');
+            sink.put(c);
+        }
+        run = key + 1;
+    }
+    sink.write(run, key - run);
+    sink.write("\":", 2);
 }
 
-template<class T>
-inline void print_sprintf(std::ostream& ostr, T val, const char* fmt)
+/// Writes a non-finite value. Returns false if the policy forbids it.
+inline bool write_row_nonfinite(BufferSink& sink, const RowSpec& spec,
+                                double val)
 {
-    char buf[1024]; // FIXME
-    int num = std::snprintf(buf, 1024, fmt, val);
-    if (num > 0) {
-        ostr.write(buf, num);
+    if (spec.nonfinite == NONFINITE_NULL) {
+        if (spec.format == ROW_JSON) {
+            sink.write("null", 4);
+        }
+        return true;
+    }
+    if (spec.nonfinite == NONFINITE_STRING) {
+        const char* str = std::isnan(val) ? "nan" : (val < 0 ? "-inf" : "inf");
+        if (spec.format == ROW_JSON) {
+            sink.put('"');
+        }
+        sink.write(str, std::strlen(str));
+        if (spec.format == ROW_JSON) {
+            sink.put('"');
+        }
+        return true;
     }
+    return false;
 }
 
-/** - T is the floating-point type to convert
-    - U is an uint64_t for float and Uint96 for double.
-    - max_digits determines the maximum number of significant digits the
-        function should attempt to write.
-    - max_digits_round is similar to max_digits just determines the number of
-        significant digits to analyze during rounding. If rounding decision
-        can not be made from that many digits, snprintf is used.
-    - fallback is a printf-style string to use for snprintf if it turns out
-        that the internal precision is insufficient.
+/** Writes a finite value of the column, quoted in CSV if it contains the
+    separator. The value is formatted with '.' and the decimal point is
+    replaced afterwards, as the snprintf fallback of print_float10_buf ignores
+    FmtInfo::dot.
 */
-template<class U, class T>
-void print_float10_impl(std::ostream& ostr, unsigned flags, int width,
-                        int prec, const FmtInfo& fmt, T val, unsigned max_digits,
-                        unsigned max_digits_round, const char* fallback)
-{
-    /** The precision losses are as follows:
-         * 5 bits due to range reduction until renormalization
-         * 5.4 bits due to imprecise division via multiplication ( 15 operations
-            each 1.5 bits max (log2(15*2^1.5))
-
-        For double:
-            96 bits total precision, 11 bits loss, 85 bits usable precision.
-            That's roughly 25 decimal digits. Use 25 for max_digits_round and
-            21 for max_digits.
-        For float:
-            64 bits total precision, 11 bits loss, 55 bits usable precision.
-            Roughly 16 decimal digits. Use 16 for max_digits_round and 12 for
-            max_digits
-    */
-
-    U signif;
-    int exp;
-    unsigned fltflags;
-
-    decompose(val, fltflags, signif, exp);
+inline void write_row_value(BufferSink& sink, const RowSpec& spec, char dot,
+                            const RowColumn& col, double val)
+{
+    static const FmtInfo fmt = { '.', '\'', NULL, 0 };
+
+    if (col.prec < 0) {
+        char buf[64];
+        char* end = cf::to_chars(buf, buf + sizeof(buf), val).ptr;
+        char* dot_pos = std::find(buf, end, '.');
+        bool quote = false;
+        if (dot_pos != end) {
+            *dot_pos = dot;
+            quote = spec.format == ROW_CSV && dot == spec.sep;
+        }
+        if (quote) {
+            sink.put('"');
+        }
+        sink.write(buf, end - buf);
+        if (quote) {
+            sink.put('"');
+        }
+        return;
+    }
 
-    // infinity and nan
-    if (fltflags & (FLOAT_INF | FLOAT_NAN)) {
-        // return print_float_special(buf, width, fltflags, flags);
-        throw std::runtime_error("Dummy");
+    // %.<prec>f of large values does not fit a local buffer, format in place
+    if (sink.overflow) {
+        return;
     }
+    char fallback[40];
+    make_printf_fmt(fallback, sizeof(fallback), FLAG_FLT_NOR, -1, col.prec);
+    char* beg = sink.out;
+    char* end = print_float10_buf(sink.out, sink.last, FLAG_FLT_NOR, -1,
+                                  col.prec, fmt, val, fallback);
+    if (end == NULL) {
+        sink.overflow = true;
+        return;
+    }
+    sink.out = end;
 
-    if (((flags & FLAG_FLT_NOR) && (exp / 3 > max_digits)) ||
-        ((flags & FLAG_FLT_EXP) && (prec + 1 > max_digits))) {
-        print_sprintf(ostr, val, fallback);
+    char* dot_pos = std::find(beg, end, '.');
+    if (dot_pos == end) {
         return;
     }
+    *dot_pos = dot;
+    if (spec.format == ROW_CSV && dot == spec.sep) {
+        // shift the value to make room for the opening quote
+        if (sink.reserve(2)) {
+            std::memmove(beg + 1, beg, end - beg);
+            *beg = '"';
+            sink.out++;
+        }
+        sink.put('"');
+    }
+}
 
-    int exp10 = 0;
+char* print_float10_row(char* first, char* last, const RowSpec& spec,
+                        const RowColumn* cols, const double* vals,
+                        unsigned count)
+{
+    bool json = spec.format == ROW_JSON;
+    char dot = json ? '.' : spec.dot;
+
+    BufferSink sink(first, last);
+    if (json) {
+        sink.put('{');
+    }
+    for (unsigned c = 0; c < count; ++c) {
+        if (c != 0) {
+            sink.put(json ? ',' : spec.sep);
+        }
+        if (json) {
+            write_json_key(sink, cols[c].key);
+        }
+        if (!std::isfinite(vals[c])) {
+            if (!write_row_nonfinite(sink, spec, vals[c])) {
+                return NULL;
+            }
+        } else {
+            write_row_value(sink, spec, dot, cols[c], vals[c]);
+        }
+    }
+    if (json) {
+        sink.put('}');
+    }
+    sink.put('\n');
+    return sink.overflow ? NULL : sink.out;
+}
 
-    // the significand now contains single 'non-fractional' bit at MSB
+// Distinguishes float keys from double keys in FormatCache::Entry::flags
+static const unsigned CACHE_KEY_FLOAT = 1u << 31;
+
+struct FormatCache::Entry {
+    uint64_t bits;
+    unsigned flags;
+    int width;
+    int prec;
+    FmtInfo fmt;
+    unsigned len;       // zero if the entry is empty
+    unsigned lru;       // in the first entry of a set: index of the LRU entry
+};
 
-    /*  The number is 1.xxx*2^n in binary.
+inline uint64_t cache_key_bits(float val)
+{
+    uint32_t fi;
+    std::memcpy(&fi, &val, sizeof(val));
+    return fi;
+}
 
-        We need to convert it to base10 encoding. This means multiplying by 2^n,
-        then dividing by such 10^m that the resulting number is within 1..10.
-        Then we can extract the digits by looking at the bits left to the 'dot'
-        position, zeroing them and multiplying the signif by 10.
+inline uint64_t cache_key_bits(double val)
+{
+    uint64_t fi;
+    std::memcpy(&fi, &val, sizeof(val));
+    return fi;
+}
 
-        Note, that the first process is effectively a conversion of 2^n to
-        appropriate 10^m. We pick such pairs of n,m that 2^n/5^m is as close to
-        1 as possible. This way we can keep the precision of computations near
-        the maximum 64 bits at all times and perform everything without needing
-        multiprecision math.
-    */
+inline unsigned cache_key_flags(float)  { return CACHE_KEY_FLOAT; }
+inline unsigned cache_key_flags(double) { return 0; }
 
-    // multiply by 2^exp
-    if (exp >= 0) {
-        const DivDesc* desc = mul2div5_desc;
+FormatCache::FormatCache(unsigned max_entries, unsigned max_len)
+{
+    unsigned sets = 1;
+    while (sets * 2 < max_entries) {
+        sets *= 2;
+    }
+    set_mask_ = sets - 1;
+    max_len_ = max_len;
+    entries_ = new Entry[sets * 2];
+    // one more slot at the end is the scratch space of the stream overloads
+    data_ = new char[(std::size_t(sets) * 2 + 1) * max_len];
+    clear();
+    reset_stats();
+}
 
-        for (unsigned i = 0; i < sizeof(mul2div5_desc)/sizeof(*mul2div5_desc); ++i, ++desc) {
+FormatCache::~FormatCache()
+{
+    delete[] entries_;
+    delete[] data_;
+}
 
-            unsigned step = desc->exp2 + desc->exp5;
-            while (exp >= step) {
-                signif = muldiv(signif, *desc);
-                exp10 += desc->exp5;
-                exp -= step;
-                signif = renormalize_signif(signif, exp);
-            }
-        }
-        // make space for a base-10 digit
-        signif = shift_r(signif, 3-exp); // consume the remaining exponent (at most 2)
-        while (extract_signif_digit(signif) == 0) {
-            signif = mul(signif, 10);
-            exp10 -= 1;
-        }
-    } else {
-        exp = -exp;
+void FormatCache::clear()
+{
+    for (unsigned i = 0; i < (set_mask_ + 1) * 2; ++i) {
+        entries_[i].len = 0;
+        entries_[i].lru = 0;
+    }
+}
 
-        const DivDesc* desc = mul5div2_desc;
-        for (unsigned i = 0; i < sizeof(mul5div2_desc)/sizeof(*mul5div2_desc); ++i, ++desc) {
+void FormatCache::reset_stats()
+{
+    stats_.hits = 0;
+    stats_.misses = 0;
+    stats_.evictions = 0;
+    stats_.uncacheable = 0;
+}
 
-            unsigned step = desc->exp2 + desc->exp5;
-            while (exp >= step) {
-                signif = muldiv(signif, *desc);
-                exp10 -= desc->exp5;
-                exp -= step;
-                signif = renormalize_signif(signif, exp);
-            }
-        }
-        // make space for a base-10 digit
-        // consume the remaining exponent (at most 3). This may make the first
-        // digit zero, we must fix this since it would make exp10 incorrect
-        signif = shift_r(signif, 3+exp);
-        while (extract_signif_digit(signif) == 0) {
-            signif = mul(signif, 10);
-            exp10 -= 1;
+/** Returns the entry for the given key or NULL on a miss. @a set is set to
+    the index of the set of the key in either case.
+*/
+template<class T>
+inline FormatCache::Entry*
+    FormatCache::lookup(unsigned flags, int width, int prec, const FmtInfo& fmt,
+                        T val, unsigned& set)
+{
+    uint64_t bits = cache_key_bits(val);
+    flags |= cache_key_flags(val);
+
+    uint64_t h = (bits ^ (uint64_t(flags) << 32) ^ (unsigned(prec) << 8) ^
+                  unsigned(width) ^ fmt.dot) * 0x9e3779b97f4a7c15;
+    set = (h >> 32) & set_mask_;
+    Entry* e = entries_ + set * 2;
+
+    for (unsigned i = 0; i < 2; ++i) {
+        Entry& c = e[i];
+        if (c.len != 0 && c.bits == bits && c.flags == flags &&
+                c.width == width && c.prec == prec && c.fmt.dot == fmt.dot &&
+                c.fmt.sep == fmt.sep && c.fmt.groups == fmt.groups &&
+                c.fmt.grouplen == fmt.grouplen) {
+            e[0].lru = i ^ 1;
+            stats_.hits++;
+            return &c;
         }
     }
+    return NULL;
+}
 
-    /*  Calculate the estimate the space needed and various other bits.
-
-        Here we can have three main formats:
+/** Stores the output [data, data + len) of the given key in the least
+    recently used entry of @a set. The output must fit max_len_.
+*/
+template<class T>
+inline void FormatCache::install(unsigned set, unsigned flags, int width,
+                                 int prec, const FmtInfo& fmt, T val,
+                                 const char* data, unsigned len)
+{
+    stats_.misses++;
+    Entry* e = entries_ + set * 2;
+    unsigned victim = e[0].lru;
+    e[0].lru = victim ^ 1;
+    Entry& c = e[victim];
+    if (c.len != 0) {
+        stats_.evictions++;
+    }
+    c.bits = cache_key_bits(val);
+    c.flags = flags | cache_key_flags(val);
+    c.width = width;
+    c.prec = prec;
+    c.fmt = fmt;
+    c.len = len;
+    std::memcpy(data_ + std::size_t(&c - entries_) * max_len_, data, len);
+}
 
-        'f','F': [-]ddd.ddd
+template<class T>
+char* FormatCache::print_impl(char* first, char* last, unsigned flags,
+                              int width, int prec, const FmtInfo& fmt, T val,
+                              const char* fallback)
+{
+    unsigned set;
+    Entry* e = lookup(flags, width, prec, fmt, val, set);
+    if (e != NULL) {
+        if (unsigned(last - first) < e->len) {
+            return NULL;
+        }
+        std::memcpy(first, data_ + std::size_t(e - entries_) * max_len_, e->len);
+        return first + e->len;
+    }
 
-        Precision specifies the minimum number of digits to appear after the
-        decimal point character. The default precision is 6. In the alternative
-        implementation decimal point character is written even if no digits
-        follow it.
+    // The output range serves as the scratch space. The entry is installed
+    // only if the output fits, so that a valid entry is not evicted for it.
+    char* end = print_float10_buf(first, last, flags, width, prec, fmt, val,
+                                  fallback);
+    if (end == NULL) {
+        return NULL;
+    }
+    if (unsigned(end - first) > max_len_) {
+        stats_.uncacheable++;
+    } else {
+        install(set, flags, width, prec, fmt, val, first, end - first);
+    }
+    return end;
+}
 
-        'e','E': [-]d.ddde±dd
+template<class T>
+void FormatCache::print_impl(std::ostream& ostr, unsigned flags, int width,
+                             int prec, const FmtInfo& fmt, T val,
+                             const char* fallback)
+{
+    unsigned set;
+    Entry* e = lookup(flags, width, prec, fmt, val, set);
+    if (e != NULL) {
+        ostr.write(data_ + std::size_t(e - entries_) * max_len_, e->len);
+        return;
+    }
 
-        The exponent contains at least two digits, more digits are used only if
-        necessary. If the value is ​0​, the exponent is also ​0​. Precision
-        specifies the minimum number of digits to appear after the decimal
-        point character. The default precision is 6. In the alternative
-        implementation decimal point character is written even if no digits
-        follow it.
+    char* scratch = data_ + std::size_t(set_mask_ + 1) * 2 * max_len_;
+    char* end = print_float10_buf(scratch, scratch + max_len_, flags, width,
+                                  prec, fmt, val, fallback);
+    if (end == NULL) {
+        stats_.uncacheable++;
+        print_float10(ostr, flags, width, prec, fmt, val, fallback);
+        return;
+    }
+    install(set, flags, width, prec, fmt, val, scratch, end - scratch);
+    ostr.write(scratch, end - scratch);
+}
 
-        'g','G': Equivalent to either 'e/E' or 'f/F'
+void FormatCache::print(std::ostream& ostr, unsigned flags, int width, int prec,
+                        const FmtInfo& fmt, float val, const char* fallback)
+{
+    print_impl(ostr, flags, width, prec, fmt, val, fallback);
+}
 
-        Let P equal the precision if nonzero, 6 if the precision is not
-        specified, or 1 if the precision is ​0​. Then, if a conversion with
-        style E would have an exponent of X:
+void FormatCache::print(std::ostream& ostr, unsigned flags, int width, int prec,
+                        const FmtInfo& fmt, double val, const char* fallback)
+{
+    print_impl(ostr, flags, width, prec, fmt, val, fallback);
+}
 
-         * if P > X ≥ −4, the conversion is with style f or F and precision
-            P − 1 − X.
-         * otherwise, the conversion is with style e or E and precision P − 1.
+char* FormatCache::print(char* first, char* last, unsigned flags, int width,
+                         int prec, const FmtInfo& fmt, float val,
+                         const char* fallback)
+{
+    return print_impl(first, last, flags, width, prec, fmt, val, fallback);
+}
 
-        Unless alternative representation is requested the trailing zeros are
-        removed, also the decimal point character is removed if no fractional
-        part is left. For infinity and not-a-number conversion style see notes.
-    */
-    unsigned int_digits_max, frac_digits_min, frac_digits_max;
+char* FormatCache::print(char* first, char* last, unsigned flags, int width,
+                         int prec, const FmtInfo& fmt, double val,
+                         const char* fallback)
+{
+    return print_impl(first, last, flags, width, prec, fmt, val, fallback);
+}
 
-    int gprec;
+FormatCache& thread_format_cache()
+{
+    static thread_local FormatCache cache;
+    return cache;
+}
 
-    unsigned buf_size;
+namespace cf {
 
-    if (flags & FLAG_FLT_NOR) {
-        // normal notation [-]ddd.ddd
-        prec = (prec < 0) ? 6 : prec;
-        int_digits_max = (exp10 >= 0) ? exp10 + 1 : 1;
-        frac_digits_min = prec;
-        frac_digits_max = prec;
-        buf_size = int_digits_max + 1 + frac_digits_max;
+static const FmtInfo c_fmtinfo = { '.', '\'', NULL, 0 };
 
-    } else if (flags & FLAG_FLT_EXP) {
-        // exponential notation [-]d.ddde±dd
-        prec = (prec < 0) ? 6 : prec;
-        int_digits_max = 1;
-        frac_digits_min = prec;
-        frac_digits_max = prec;
-        buf_size = int_digits_max + 1 + frac_digits_max + 6; // e[+-]\d\d\d\d
+inline to_chars_result make_result(char* ptr, std::errc ec)
+{
+    to_chars_result res;
+    res.ptr = ptr;
+    res.ec = ec;
+    return res;
+}
 
-    } else {
-        // 'g': either of the above with custom rules
-        flags |= FLAG_FLT_G;
-        prec = (prec < 0)  ? 6 : prec;
-        prec = (prec == 0) ? 1 : prec;
-        gprec = prec;
-        if ((prec > exp10) && (exp10 >= -4)) {
-            // normal notation
-            flags |= FLAG_FLT_NOR;
-            prec = prec - 1 - exp10;
-            int_digits_max = (exp10 >= 0) ? exp10 + 1 : 1;
-        } else {
-            // exponential notation
-            flags |= FLAG_FLT_EXP;
-            prec = prec - 1;
-            int_digits_max = 1;
-        }
-        frac_digits_max = prec;
-        frac_digits_min = 0; // can erase trailing zeros
-        if (flags & FLAG_ALT) {
-            frac_digits_min = prec;
-        }
-        // Either e[+-]\d\d\d\d or four prepended zeros
-        buf_size = int_digits_max + 1 + frac_digits_max + 6;
-    }
-
-    // Take thousand separators into account when estimating needed characters
-    unsigned sep_count = 0;
-    if (fmt.grouplen > 0) {
-        // Rounding may create additional digit and an additional separator
-        //sep_count = count_thousand_seps(fmt.groups, fmt.grouplen, int_digits_max+1);
-        //buf_size += sep_count;
-    }
-
-    // Reserve space
-    //buf.reserve(buf_size+padspace);
-    bool is_buf_alloced = false;
-    char static_buf[128];
-    char* buf;
-    if (buf_size > 128) {
-        buf = new char[buf_size];   // FIXME: use RAII
-        is_buf_alloced = true;
-    } else {
-        buf = static_buf;
+inline to_chars_result copy_result(char* first, char* last,
+                                   const char* beg, const char* end)
+{
+    if (last - first < end - beg) {
+        return make_result(last, std::errc::value_too_large);
     }
+    return make_result(std::copy(beg, end, first), std::errc());
+}
 
-    //char* bufbegin = buf.get() + padspace;
-    char* bufbegin = buf;
-
-    char* outbeg = bufbegin + 2 + sep_count;// Grouping will be added right to left
-                                            // Also add space for sign and rouding
-    char* out = outbeg;
-
-    unsigned idig = 0;
-    char last_signif;
+/// Formats @a value using the printf conversion given by @a flags.
+template<class T>
+to_chars_result to_chars_printf(char* first, char* last, T value,
+                                unsigned flags, int prec)
+{
+    char fallback[32];
+    make_printf_fmt(fallback, sizeof(fallback), flags, -1, prec);
 
-    // Extract the integral part, add the decimal dot
-    if (exp10 >= 0 || flags & FLAG_FLT_EXP) {
-        for (unsigned i = 0; i < int_digits_max; ++i, ++idig) {
-            *out++ = last_signif = extract_update_signif_digit(signif) + '0';
-        }
+    char* end = print_float10_buf(first, last, flags, -1, prec, c_fmtinfo,
+                                  value, fallback);
+    if (end == NULL) {
+        return make_result(last, std::errc::value_too_large);
+    }
+    return make_result(end, std::errc());
+}
 
-    } else {
-        // The representation has no integral part
-        exp10++;
-        *out++ = '0';
-    }
-
-    // Always add the dot. We can remove it later.
-    char* dotpos = out;
-    *out++ = '.'; // just use a known value, we'll change it to fmt.dot later
-
-    // Extract the fractional part
-    for (unsigned i = 0; i < frac_digits_max; ++i, ++idig) {
-        *out++ = last_signif = extract_update_signif_digit(signif) + '0';
-    }
-
-    // Round using "round to nearest" mode (halfway cases are rounded to even)
-    // TODO: Use current rounding mode
-
-    // Since the significand is not precise we must be extremely careful errors
-    // do not propagate to rounding.
-    bool round_away_zero = false;
-    char hidden_digit = extract_signif_digit(signif) + '0';
-    if (hidden_digit > '5') {
-        round_away_zero = true;
-    } else if (hidden_digit == '5') {
-        // We consider at most decimal_dig + 2 digits.
-        extract_update_signif_digit(signif); // previous extraction did not
-                                             // update signif
-        unsigned idig2 = idig + 1;
-        char dig = '0';
-        while (dig == '0' && idig2 < max_digits_round) {
-            dig = extract_update_signif_digit(signif) + '0';
-            idig2++;
-        }
+/// Formats @a value as hexadecimal floating-point number without the 0x prefix
+template<class T>
+to_chars_result to_chars_hex(char* first, char* last, T value, int prec)
+{
+    unsigned fltflags;
+    uint64_t signif;
+    unsigned frac_digits;
+    int exp;
+    decompose_hex(value, fltflags, signif, frac_digits, exp);
 
-        if (dig > '0') {
-            round_away_zero = true;
-        } else if (idig2 == max_digits_round) {
-            if (is_buf_alloced) {
-                delete[] buf;
-            }
-            print_sprintf(ostr, val, fallback);
-            return;
-        }
-    } else if (hidden_digit == '4') {
-        unsigned idig2 = idig + 1;
-        extract_update_signif_digit(signif);
-        char dig = extract_update_signif_digit(signif) + '0';
-        while (dig == '9' && idig2 < max_digits_round) {
-            dig = extract_update_signif_digit(signif) + '0';
-            idig2++;
-        }
-        if (dig == '9' && idig2 == max_digits_round) {
-            if (is_buf_alloced) {
-                delete[] buf;
-            }
-            print_sprintf(ostr, val, fallback);
-            return;
-        }
+    BufferSink sink(first, last);
+    print_float_hex_impl(sink, FLAG_NONE, -1, prec, fltflags, signif,
+                         frac_digits, exp, false);
+    if (sink.overflow) {
+        return make_result(last, std::errc::value_too_large);
     }
+    return make_result(sink.out, std::errc());
+}
 
-    if (round_away_zero) {
-        char* oi = out-1;
+/// Computes the 128-bit product of a and b
+inline void mul128(uint64_t a, uint64_t b, uint64_t& hi, uint64_t& lo)
+{
+    uint64_t al = a & 0xffffffff;
+    uint64_t ah = a >> 32;
+    uint64_t bl = b & 0xffffffff;
+    uint64_t bh = b >> 32;
+    uint64_t ll = al * bl;
+    uint64_t lh = al * bh;
+    uint64_t hl = ah * bl;
+    uint64_t mid = (ll >> 32) + (lh & 0xffffffff) + (hl & 0xffffffff);
+    lo = (mid << 32) | (ll & 0xffffffff);
+    hi = ah * bh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+}
 
-        // Fractional part
-        bool rounded = false;
-        if (*oi != '.') {
+/*  Returns the integral part of cp*g/2^128 (2^64 for float) rounded to odd,
+    i.e. with the lowest bit set if the fraction is not zero. g exceeds the
+    exact power of ten by less than one unit, thus a fraction of at most one
+    unit of the 64 (32) bits below the result is taken as zero.
+*/
+inline uint64_t round_to_odd(const Pow10Desc& g, uint64_t cp)
+{
+    uint64_t xh, xl, yh, yl;
+    mul128(g.lo, cp, xh, xl);
+    mul128(g.hi, cp, yh, yl);
+    uint64_t z = yl + xh;
+    yh += z < xh;
+    return yh | (z > 1);
+}
 
-            while (*oi == '9') {
-                *oi-- = '0';
-            }
-            if (*oi != '.') {
-                *oi += 1;
-                rounded = true;
-            }
-        }
+inline uint32_t round_to_odd(const Pow10Desc& g, uint32_t cp)
+{
+    uint64_t hi, lo;
+    mul128(g.hi + 1, cp, hi, lo);
+    return uint32_t(hi) | ((lo >> 32) > 1);
+}
 
-        // Integer part
-        if (!rounded) {
-            // *oi == '.'
-            oi--;
-            while (*oi == '9') {
-                *oi-- = '0';
-            }
-            // Either we found a non-9 digit or we are at the beginning
-            if (oi >= outbeg) {
-                *oi += 1;
-            } else {
-                // The number was 9.9999... *10^m
-                // We need to add an additional digit, i.e. exp10 has changed.
-                // No additional digits become 'visible' thus rounding does not
-                // need to be repeated
-                *oi = '1';
-                outbeg--;
-                exp10++;
-
-                if (flags & FLAG_FLT_G) {
-                    // As exp10 has changed, we may need to switch the format.
-                    // That's easy as the number is 10^n.
-
-                    if (flags & FLAG_FLT_NOR && gprec == exp10) {
-                        flags &= ~FLAG_FLT_NOR;
-                        flags |= FLAG_FLT_EXP;
-                        prec = prec + exp10; // or gprec - 1
-
-                        // Reprint the number
-                        out = bufbegin;
-                        out = std::strncpy(out, "1.", 2);
-                        dotpos = bufbegin + 1;
-                        out = std::fill_n(out, prec, '0');
-
-                    } else if (flags & FLAG_FLT_EXP && exp10 == -4) {
-                        flags &= ~FLAG_FLT_EXP;
-                        flags |= FLAG_FLT_NOR;
-                        prec = prec - exp10; // or gprec - 1 - exp10
-
-                        // Reprint the number
-                        out = bufbegin;
-                        out = std::strncpy(out, "0.0001", 6);
-                        dotpos = bufbegin + 1;
-                        out = std::fill_n(out, prec - 4, '0');
-                    }
-                    frac_digits_max = prec;
-                    frac_digits_min = 0; // can erase trailing zeros
-                    if (flags & FLAG_ALT) {
-                        frac_digits_min = prec;
-                    }
-                } else if (flags & FLAG_FLT_NOR) {
-                    // nothing to do, precision did not change
-                } else if (flags & FLAG_FLT_EXP) {
-                    // reposition the dot
-                    *dotpos = *(dotpos-1);
-                    *--dotpos = '.';
-                    out--;
-                }
-            }
+/** Finds the shortest decimal d*10^exp10 that rounds to the binary value
+    c*2^q and, if there are several, the one closest to it. This is the
+    Schubfach algorithm by R. Giulietti: the rounding interval of the value is
+    scaled by 10^-k exactly enough to decide which of the integers, or of the
+    multiples of ten, in it is the result. @a lower_closer is set at the lower
+    end of a binade, where the interval is asymmetric. The result may have
+    trailing zeros.
+*/
+template<class U>
+U find_shortest(U c, int q, bool lower_closer, int& exp10)
+{
+    bool even = (c % 2) == 0;
+    U cbl = 4 * c - 2 + lower_closer;
+    U cb = 4 * c;
+    U cbr = 4 * c + 2;
+
+    // k = floor(log10(2^q)), or floor(log10(3/4 * 2^q)) if lower_closer,
+    // h = q + floor(log2(10^-k)) + 1
+    int k = (q * 1262611 - (lower_closer ? 524031 : 0)) >> 22;
+    int h = q + ((-k * 1741647) >> 19) + 1;
+    const Pow10Desc& g = shortest_pow10_desc[-k - shortest_pow10_min];
+    U vbl = round_to_odd(g, U(cbl << h));
+    U vb = round_to_odd(g, U(cb << h));
+    U vbr = round_to_odd(g, U(cbr << h));
+
+    // the bounds of the interval are included if c is even
+    U lower = vbl + !even;
+    U upper = vbr - !even;
+
+    U s = vb / 4;
+    if (s >= 10) {
+        // at most one multiple of ten is in the interval
+        U sp = s / 10;
+        bool up_inside = lower <= 40 * sp;
+        bool wp_inside = 40 * sp + 40 <= upper;
+        if (up_inside != wp_inside) {
+            exp10 = k + 1;
+            return sp + wp_inside;
         }
     }
-
-    // Remove trailing zeros and dot if possible
-    char* oi = out-1;
-    while ((oi != dotpos + frac_digits_min) && (*oi == '0')) {
-        oi--;
+    exp10 = k;
+    bool u_inside = lower <= 4 * s;
+    bool w_inside = 4 * s + 4 <= upper;
+    if (u_inside != w_inside) {
+        return s + w_inside;
     }
+    // both s and s + 1 are in the interval, pick the closer one
+    U mid = 4 * s + 2;
+    bool round_up = vb > mid || (vb == mid && (s & 1) != 0);
+    return s + round_up;
+}
 
-    if (oi == dotpos && !(flags & FLAG_FLT_G)) {
-        oi--;
-    } else {
-        // Using fixed value for dot no longer beneficial
-        *dotpos = fmt.dot;
+/// Returns the decimal significand of finite nonzero @a value, see above
+inline uint64_t find_shortest(double value, int& exp10)
+{
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    uint64_t m = bits & ((uint64_t(1) << 52) - 1);
+    int e = (bits >> 52) & 0x7ff;
+    if (e == 0) {
+        return find_shortest<uint64_t>(m, -1074, false, exp10);
+    }
+    uint64_t c = m | (uint64_t(1) << 52);
+    int q = e - 1075;
+    if (q <= 0 && q > -53 && (c & ((uint64_t(1) << -q) - 1)) == 0) {
+        // an integer, which is exact
+        exp10 = 0;
+        return c >> -q;
     }
-    out = oi+1;
+    return find_shortest<uint64_t>(c, q, m == 0 && e > 1, exp10);
+}
 
-    // Add thousand separators
-    if (fmt.grouplen > 0) {
-        //outbeg = add_thousand_seps(outbeg, fmt.sep, fmt.groups, fmt.grouplen,
-        //                            outbeg, dotpos);
+inline uint64_t find_shortest(float value, int& exp10)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    uint32_t m = bits & ((uint32_t(1) << 23) - 1);
+    int e = (bits >> 23) & 0xff;
+    if (e == 0) {
+        return find_shortest<uint32_t>(m, -149, false, exp10);
+    }
+    uint32_t c = m | (uint32_t(1) << 23);
+    int q = e - 150;
+    if (q <= 0 && q > -24 && (c & ((uint32_t(1) << -q) - 1)) == 0) {
+        exp10 = 0;
+        return c >> -q;
     }
+    return find_shortest<uint32_t>(c, q, m == 0 && e > 1, exp10);
+}
 
-    // Add exponent
-    if (flags & FLAG_FLT_EXP) {
-        *out++ = (flags & FLAG_UPPERCASE) ? 'E' : 'e';
-        *out++ = (exp10 < 0) ? '-' : '+';
-        exp10 = std::abs(exp10);
+/** Formats @a value using the shortest representation that round-trips. If
+    @a fmt is zero, the shorter of fixed and scientific notations is used.
+*/
+template<class T>
+to_chars_result to_chars_shortest(char* first, char* last, T value,
+                                  chars_format fmt)
+{
+    if (!std::isfinite(value)) {
+        return to_chars_printf(first, last, value, FLAG_FLT_EXP, 0);
+    }
+    if (fmt == chars_format::hex) {
+        return to_chars_hex(first, last, value, -1);
+    }
 
-        if (exp10 < 10) {
-            *out++ = '0';
-            *out++ = '0' + exp10;
-        } else if (exp10 < 100) {
-            *out++ = '0' + exp10 / 10;
-            *out++ = '0' + exp10 % 10;
-        } else {
-            *out++ = '0' + exp10 / 10 / 10;
-            *out++ = '0' + exp10 / 10 % 10;
-            *out++ = '0' + exp10 % 10;
+    uint64_t d = 0;
+    int exp10 = 0;
+    if (value != 0) {
+        d = find_shortest(value, exp10);
+        while (d % 10 == 0) {
+            d /= 10;
+            exp10++;
         }
     }
+    char digit_buf[20];
+    char* digits_end = digit_buf + sizeof(digit_buf);
+    char* digits_beg = format_uint64_r(digits_end, d, 1);
+    int digits = digits_end - digits_beg;
+    exp10 += digits - 1;
+
+    // [-]d.ddde±dd
+    int sci_len = digits + (digits > 1 ? 1 : 0) + 2 +
+            (std::abs(exp10) >= 100 ? 3 : 2);
+    int fixed_len;
+    if (exp10 >= digits - 1) {
+        fixed_len = exp10 + 1;                      // ddd000
+    } else if (exp10 >= 0) {
+        fixed_len = digits + 1;                     // ddd.ddd
+    } else {
+        fixed_len = 2 + (-exp10 - 1) + digits;      // 0.000ddd
+    }
 
-    // Write to buffer along to any padding
-    char sign[2];
-    sign[0] = ' ';
-    unsigned sign_sz = 1;
-    if (fltflags & FLOAT_NEG) {
-        sign[0] = '-';
-    } else if (flags & FLAG_SIGN) {
-        sign[0] = '+';
-    } else if (flags & FLAG_SPACE) {
-        sign[0] = ' ';
+    bool use_fixed;
+    if (fmt == chars_format::fixed) {
+        use_fixed = true;
+    } else if (fmt == chars_format::scientific) {
+        use_fixed = false;
+    } else if (fmt == chars_format::general) {
+        use_fixed = (exp10 >= -4) && (exp10 < 6);
     } else {
-        sign_sz = 0;
+        use_fixed = fixed_len <= sci_len;
     }
 
-    width -= out - outbeg - sign_sz;
+    if (use_fixed && exp10 >= digits - 1) {
+        // integers are printed exactly, as std::to_chars does
+        return to_chars_printf(first, last, value, FLAG_FLT_NOR, 0);
+    }
+    bool neg = std::signbit(value);
+    if (last - first < (use_fixed ? fixed_len : sci_len) + neg) {
+        return make_result(last, std::errc::value_too_large);
+    }
 
-    if (flags & FLAG_LEFT) {
-        // left adjusted
-        if (sign_sz > 0) {
-            ostr.put(sign[0]);
-        }
-        ostr.write(outbeg, out-outbeg);
-        if (width > 0) {
-            fill_spaces(ostr, width);
+    char* out = first;
+    if (neg) {
+        *out++ = '-';
+    }
+    if (use_fixed) {
+        if (exp10 >= 0) {
+            out = std::copy(digits_beg, digits_beg + exp10 + 1, out);
+            *out++ = '.';
+            out = std::copy(digits_beg + exp10 + 1, digits_end, out);
+        } else {
+            *out++ = '0';
+            *out++ = '.';
+            out = std::fill_n(out, -exp10 - 1, '0');
+            out = std::copy(digits_beg, digits_end, out);
         }
-        return;
+        return make_result(out, std::errc());
     }
 
-    if (flags & FLAG_ZERO) {
-        // fill zeros between pre and data
-        if (sign_sz > 0) {
-            ostr.put(sign[0]);
-        }
-        if (width > 0) {
-            fill_zeros(ostr, width);
-        }
-        ostr.write(outbeg, out-outbeg);
+    *out++ = *digits_beg;
+    if (digits > 1) {
+        *out++ = '.';
+        out = std::copy(digits_beg + 1, digits_end, out);
     }
+    *out++ = 'e';
+    *out++ = exp10 < 0 ? '-' : '+';
+    char exp_buf[4];
+    char* exp_beg = format_uint64_r(exp_buf + sizeof(exp_buf), std::abs(exp10), 2);
+    return make_result(std::copy(exp_beg, exp_buf + sizeof(exp_buf), out),
+                       std::errc());
+}
 
-    // right adjusted
-    if (width > 0) {
-        fill_spaces(ostr, width);
+template<class T>
+to_chars_result to_chars_prec(char* first, char* last, T value,
+                              chars_format fmt, int prec)
+{
+    if (prec < 0) {
+        prec = 6;
     }
-    if (sign_sz > 0) {
-        ostr.put(sign[0]);
+    if (fmt == chars_format::fixed) {
+        return to_chars_printf(first, last, value, FLAG_FLT_NOR, prec);
     }
-    ostr.write(outbeg, out-outbeg);
-    if (is_buf_alloced) {
-        delete[] buf;
+    if (fmt == chars_format::scientific) {
+        return to_chars_printf(first, last, value, FLAG_FLT_EXP, prec);
     }
+    if (fmt == chars_format::hex) {
+        return to_chars_hex(first, last, value, prec);
+    }
+    return to_chars_printf(first, last, value, FLAG_NONE, prec);
 }
 
-void __attribute__((noinline))
-     print_float10(std::ostream& ostr, unsigned flags, int width,
-                        int prec, const FmtInfo& fmt, float val, const char* fallback)
+to_chars_result to_chars(char* first, char* last, float value)
 {
-    print_float10_impl<uint64_t>(ostr, flags, width, prec, fmt, val, 11, 16, fallback);
+    return to_chars_shortest(first, last, value, chars_format());
 }
 
-void __attribute__((noinline))
-     print_float10(std::ostream& ostr, unsigned flags, int width,
-                   int prec, const FmtInfo& fmt, double val, const char* fallback)
+to_chars_result to_chars(char* first, char* last, double value)
+{
+    return to_chars_shortest(first, last, value, chars_format());
+}
+
+to_chars_result to_chars(char* first, char* last, float value,
+                         chars_format fmt)
+{
+    return to_chars_shortest(first, last, value, fmt);
+}
+
+to_chars_result to_chars(char* first, char* last, double value,
+                         chars_format fmt)
+{
+    return to_chars_shortest(first, last, value, fmt);
+}
+
+to_chars_result to_chars(char* first, char* last, float value,
+                         chars_format fmt, int precision)
 {
-    print_float10_impl<Uint96>(ostr, flags, width, prec, fmt, val, 21, 24, fallback);
+    return to_chars_prec(first, last, value, fmt, precision);
 }
+
+to_chars_result to_chars(char* first, char* last, double value,
+                         chars_format fmt, int precision)
+{
+    return to_chars_prec(first, last, value, fmt, precision);
+}
+
+} // namespace cf
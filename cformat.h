@@ -18,6 +18,11 @@
 #ifndef CFORMAT_H
 #define CFORMAT_H
 
+#include <iosfwd>
+#include <cstddef>
+#include <charconv>
+#include <stdint.h>
+
 /// Flags for standard format string flags
 enum FormatFlags {
     FLAG_NONE  = 0,
@@ -36,18 +41,290 @@ enum FormatFlags {
     FLAG_FLT_NOR = 1 << 19,         // floating-point without exponent (f format)
     FLAG_FLT_EXP = 1 << 20,         // floating-point with exponent (e format)
     FLAG_FLT_G = 1 << 21,           // floating-point with or without exponent (g format)
+    FLAG_FLT_HEX = 1 << 22,         // hexadecimal floating-point (a format)
 };
 
-struct FmtInfo {
-    char dot;
-    char sep;
+template<class CharT>
+struct BasicFmtInfo {
+    CharT dot;
+    CharT sep;
     const char* groups;
     unsigned grouplen;
 };
 
+typedef BasicFmtInfo<char> FmtInfo;
+
+/** 16-bit floating-point values, stored as their bit patterns. Float16 is the
+    IEEE 754 binary16 format, BFloat16 is the upper half of an IEEE 754 float.
+*/
+struct Float16 {
+    uint16_t bits;
+};
+
+struct BFloat16 {
+    uint16_t bits;
+};
+
+/// Converts the value to float exactly
+float to_float(Float16 val);
+float to_float(BFloat16 val);
+
 void print_float10(std::ostream& ostr, unsigned flags, int width,
                         int prec, const FmtInfo& fmt, float val, const char* fallback);
 void print_float10(std::ostream& ostr, unsigned flags, int width,
                    int prec, const FmtInfo& fmt, double val, const char* fallback);
 
+/** Same as above, except that the output is written to the character range
+    [first, last). Returns the end of the written output or NULL if the range
+    is too small.
+*/
+char* print_float10(char* first, char* last, unsigned flags, int width,
+                    int prec, const FmtInfo& fmt, float val, const char* fallback);
+char* print_float10(char* first, char* last, unsigned flags, int width,
+                    int prec, const FmtInfo& fmt, double val, const char* fallback);
+
+/** Same as above for 16-bit values. The value is not converted to float, it
+    is formatted directly. The fallback is used with snprintf on the value
+    converted to float.
+*/
+void print_float10(std::ostream& ostr, unsigned flags, int width,
+                   int prec, const FmtInfo& fmt, Float16 val, const char* fallback);
+void print_float10(std::ostream& ostr, unsigned flags, int width,
+                   int prec, const FmtInfo& fmt, BFloat16 val, const char* fallback);
+char* print_float10(char* first, char* last, unsigned flags, int width,
+                    int prec, const FmtInfo& fmt, Float16 val, const char* fallback);
+char* print_float10(char* first, char* last, unsigned flags, int width,
+                    int prec, const FmtInfo& fmt, BFloat16 val, const char* fallback);
+
+/** Same as above for the other character types: wchar_t, char16_t, char32_t
+    and, if the compiler supports it, char8_t. The digits are generated the
+    same way as for char, each character is widened as it is stored to the
+    stream or the range. The output is plain ASCII except for fmt.dot.
+*/
+template<class CharT>
+void print_float10(std::basic_ostream<CharT>& ostr, unsigned flags, int width,
+                   int prec, const BasicFmtInfo<CharT>& fmt, float val,
+                   const char* fallback);
+template<class CharT>
+void print_float10(std::basic_ostream<CharT>& ostr, unsigned flags, int width,
+                   int prec, const BasicFmtInfo<CharT>& fmt, double val,
+                   const char* fallback);
+template<class CharT>
+CharT* print_float10(CharT* first, CharT* last, unsigned flags, int width,
+                     int prec, const BasicFmtInfo<CharT>& fmt, float val,
+                     const char* fallback);
+template<class CharT>
+CharT* print_float10(CharT* first, CharT* last, unsigned flags, int width,
+                     int prec, const BasicFmtInfo<CharT>& fmt, double val,
+                     const char* fallback);
+
+/** Formats @a count values into [first, last), each followed by @a sep.
+    Returns the end of the written output or NULL if the range is too small.
+    If @a cache is not NULL, the values are looked up there first.
+*/
+class FormatCache;
+
+char* print_float10_batch(char* first, char* last, unsigned flags, int width,
+                          int prec, const FmtInfo& fmt, const float* vals,
+                          unsigned count, char sep, const char* fallback,
+                          FormatCache* cache = NULL);
+char* print_float10_batch(char* first, char* last, unsigned flags, int width,
+                          int prec, const FmtInfo& fmt, const double* vals,
+                          unsigned count, char sep, const char* fallback,
+                          FormatCache* cache = NULL);
+
+/// Same as above for 16-bit values. FormatCache does not support them.
+char* print_float10_batch(char* first, char* last, unsigned flags, int width,
+                          int prec, const FmtInfo& fmt, const Float16* vals,
+                          unsigned count, char sep, const char* fallback);
+char* print_float10_batch(char* first, char* last, unsigned flags, int width,
+                          int prec, const FmtInfo& fmt, const BFloat16* vals,
+                          unsigned count, char sep, const char* fallback);
+
+/// Format of a column of print_float10_matrix. width is the minimum width.
+struct ColumnSpec {
+    unsigned flags;
+    int width;
+    int prec;
+};
+
+/** Computes the width of each column of the row-major @a rows x @a cols
+    matrix @a vals: the length of the longest value of the column formatted
+    with the spec of the column, but at least the width given there.
+
+    The lengths of %e and %f values follow from the number of integer digits
+    or exponent digits, which are estimated from the binary exponent. Values
+    are formatted only if they are too close to a power of ten to decide
+    whether rounding adds a digit. %g and %a values are always formatted.
+
+    Returns the number of characters print_float10_matrix writes.
+*/
+std::size_t matrix_column_widths(const ColumnSpec* specs, const FmtInfo& fmt,
+                                 const float* vals, unsigned rows,
+                                 unsigned cols, int* widths);
+std::size_t matrix_column_widths(const ColumnSpec* specs, const FmtInfo& fmt,
+                                 const double* vals, unsigned rows,
+                                 unsigned cols, int* widths);
+
+/** Writes the matrix as a table into [first, last). Each value is padded to
+    the width of its column as given by @a widths, the values in a row are
+    separated by @a sep and each row is followed by a newline. Returns the end
+    of the written output or NULL if the range is too small.
+*/
+char* print_float10_matrix(char* first, char* last, const ColumnSpec* specs,
+                           const int* widths, const FmtInfo& fmt,
+                           const float* vals, unsigned rows, unsigned cols,
+                           char sep);
+char* print_float10_matrix(char* first, char* last, const ColumnSpec* specs,
+                           const int* widths, const FmtInfo& fmt,
+                           const double* vals, unsigned rows, unsigned cols,
+                           char sep);
+
+/// Output grammar of print_float10_row
+enum RowFormat {
+    ROW_JSON,           // {"key":value,...}, one object per line
+    ROW_CSV             // value,value,..., one record per line
+};
+
+/// What print_float10_row writes for infinities and NaNs
+enum NonFinitePolicy {
+    NONFINITE_NULL,     // null in JSON, an empty field in CSV
+    NONFINITE_STRING,   // inf, -inf or nan, as a string in JSON
+    NONFINITE_ERROR     // print_float10_row fails
+};
+
+struct RowSpec {
+    RowFormat format;
+    NonFinitePolicy nonfinite;
+    char dot;           // decimal point in CSV. JSON always uses '.'
+    char sep;           // field separator in CSV
+};
+
+/** Column of print_float10_row. If prec is negative, the value is written in
+    the shortest form that round-trips, as cf::to_chars does without a format.
+    Otherwise it is written as %.<prec>f. key is the JSON member name, it is
+    not used for CSV.
+*/
+struct RowColumn {
+    const char* key;
+    int prec;
+};
+
+/** Writes the @a count values of a record as one line of JSON or CSV into
+    [first, last). The output follows the grammar of the format regardless of
+    the values: numbers never have a leading '+', non-finite values are
+    written according to spec.nonfinite, JSON keys are escaped and CSV fields
+    are quoted if the decimal point is the field separator. Returns the end
+    of the written output, or NULL if the range is too small or if a value is
+    not finite and spec.nonfinite is NONFINITE_ERROR.
+*/
+char* print_float10_row(char* first, char* last, const RowSpec& spec,
+                        const RowColumn* cols, const double* vals,
+                        unsigned count);
+
+/** Cache of formatted values for streams that repeat a small set of values.
+    The key is the bit pattern of the value together with all formatting
+    parameters and the FmtInfo contents. The finished output is stored, so a
+    hit costs a hash lookup and a copy. fmt.groups is compared by address, not
+    by contents: a grouping string that is modified in place must be followed
+    by clear().
+
+    The cache is a 2-way set associative table with max_entries entries, each
+    storing at most max_len characters. Longer outputs are not cached. On a
+    miss the least recently used entry of the set is evicted.
+
+    The cache is not synchronized. Use one instance per thread, e.g. the one
+    returned by thread_format_cache().
+*/
+class FormatCache {
+public:
+    struct Stats {
+        unsigned long long hits;
+        unsigned long long misses;
+        unsigned long long evictions;
+        unsigned long long uncacheable;     // output longer than max_len
+    };
+
+    /// max_entries is rounded up to a power of two
+    FormatCache(unsigned max_entries = 4096, unsigned max_len = 32);
+    ~FormatCache();
+
+    void print(std::ostream& ostr, unsigned flags, int width, int prec,
+               const FmtInfo& fmt, float val, const char* fallback);
+    void print(std::ostream& ostr, unsigned flags, int width, int prec,
+               const FmtInfo& fmt, double val, const char* fallback);
+
+    /** Same as the buffer overloads of print_float10. Outputs longer than
+        max_len are written but not cached, they do not evict other entries.
+    */
+    char* print(char* first, char* last, unsigned flags, int width, int prec,
+                const FmtInfo& fmt, float val, const char* fallback);
+    char* print(char* first, char* last, unsigned flags, int width, int prec,
+                const FmtInfo& fmt, double val, const char* fallback);
+
+    /// Removes all entries. The statistics are not reset.
+    void clear();
+
+    const Stats& stats() const { return stats_; }
+    void reset_stats();
+
+    struct Entry;
+
+private:
+    FormatCache(const FormatCache&);
+    FormatCache& operator=(const FormatCache&);
+
+    template<class T>
+    char* print_impl(char* first, char* last, unsigned flags, int width,
+                     int prec, const FmtInfo& fmt, T val, const char* fallback);
+    template<class T>
+    void print_impl(std::ostream& ostr, unsigned flags, int width, int prec,
+                    const FmtInfo& fmt, T val, const char* fallback);
+    template<class T>
+    Entry* lookup(unsigned flags, int width, int prec, const FmtInfo& fmt,
+                  T val, unsigned& set);
+    template<class T>
+    void install(unsigned set, unsigned flags, int width, int prec,
+                 const FmtInfo& fmt, T val, const char* data, unsigned len);
+
+    Entry* entries_;
+    char* data_;
+    unsigned set_mask_;
+    unsigned max_len_;
+    Stats stats_;
+};
+
+/// Returns a cache local to the calling thread, created with default limits
+FormatCache& thread_format_cache();
+
+/*  Drop-in replacement for the floating-point overloads of std::to_chars. The
+    semantics are the same as those of the standard functions:
+
+     * without a format the shortest representation that round-trips is used,
+        either in fixed or scientific notation, whichever is shorter
+     * with a format but without a precision the shortest representation that
+        round-trips is used in the given format
+     * with a precision, the output is the same as printf with %f, %e, %g or %a
+        (without the 0x prefix) would produce in the C locale
+
+    On failure, ptr is set to last and ec to std::errc::value_too_large.
+*/
+namespace cf {
+
+using std::chars_format;
+using std::to_chars_result;
+
+to_chars_result to_chars(char* first, char* last, float value);
+to_chars_result to_chars(char* first, char* last, double value);
+to_chars_result to_chars(char* first, char* last, float value,
+                         chars_format fmt);
+to_chars_result to_chars(char* first, char* last, double value,
+                         chars_format fmt);
+to_chars_result to_chars(char* first, char* last, float value,
+                         chars_format fmt, int precision);
+to_chars_result to_chars(char* first, char* last, double value,
+                         chars_format fmt, int precision);
+
+} // namespace cf
+
 #endif
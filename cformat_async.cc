@@ -0,0 +1,368 @@
+/*
+    Copyright (C) 2014  Povilas Kanapickas <povilas@radix.lt>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <stdint.h>
+
+#include "cformat_async.h"
+#include "cformat_impl.h"
+
+// Marks records that hold a float. Bit 31 is not used by FormatFlags.
+static const unsigned ASYNC_FLOAT = 1u << 31;
+
+static const unsigned ASYNC_MAX_FMTS = 256;
+static const unsigned ASYNC_BATCH_SIZE = 1024;
+static const unsigned ASYNC_BUF_SIZE = 64 * 1024;
+// Number of empty polls before the background thread starts to sleep
+static const unsigned ASYNC_IDLE_SPINS = 1000;
+static const unsigned ASYNC_IDLE_SLEEP_US = 50;
+
+struct AsyncRecord {
+    uint64_t bits;      // bit pattern of the value
+    unsigned flags;     // FormatFlags, ASYNC_FLOAT for float values
+    int width;
+    int prec;
+    unsigned char fmt_id;
+    char sep;
+};
+
+/*  The ring buffer is the bounded queue by D. Vyukov. Each slot carries a
+    sequence number: a slot at position pos is free for the producer that
+    claimed ticket pos if seq == pos and holds a published record if
+    seq == pos + 1. The consumer frees the slot for the next round by setting
+    seq to pos + capacity. Producers claim tickets with a CAS on head, thus
+    any number of them may push concurrently. There is a single consumer.
+*/
+struct AsyncSlot {
+    std::atomic<uint64_t> seq;
+    AsyncRecord rec;
+};
+
+struct AsyncFormatter::State {
+    // written by the producers
+    alignas(64) std::atomic<uint64_t> head;
+    std::atomic<uint64_t> dropped;
+
+    // written by the consumer
+    alignas(64) std::atomic<uint64_t> written;
+    std::atomic<uint64_t> batches;
+    uint64_t tail;
+
+    // read-only after construction
+    alignas(64) AsyncSlot* slots;
+    uint64_t mask;
+    AsyncFormatter::Policy policy;
+    std::ostream* ostr;
+
+    FmtInfo fmts[ASYNC_MAX_FMTS];
+    std::atomic<unsigned> fmt_count;
+    std::mutex fmt_mutex;
+
+    std::atomic<bool> stop;
+    std::mutex ostr_mutex;              // held while the stream is used
+    std::atomic<uint64_t> flush_target;
+    uint64_t flushed;
+    std::mutex flush_mutex;
+    std::condition_variable flush_cv;
+
+    std::thread thread;
+};
+
+/** Formats a record into [first, last). Returns the end of the output or NULL
+    if the range is too small.
+*/
+static char* format_record(const AsyncRecord& r, const FmtInfo& fmt,
+                           const char* fallback, char* first, char* last)
+{
+    char* out;
+    if (r.flags & ASYNC_FLOAT) {
+        uint32_t bits = r.bits;
+        float val;
+        std::memcpy(&val, &bits, sizeof(val));
+        out = print_float10(first, last, r.flags & ~ASYNC_FLOAT, r.width,
+                            r.prec, fmt, val, fallback);
+    } else {
+        double val;
+        std::memcpy(&val, &r.bits, sizeof(val));
+        out = print_float10(first, last, r.flags, r.width, r.prec, fmt, val,
+                            fallback);
+    }
+    if (out && r.sep) {
+        if (out == last) {
+            return NULL;
+        }
+        *out++ = r.sep;
+    }
+    return out;
+}
+
+/// Writes a record that does not fit the batch buffer directly to the stream
+static void write_record(std::ostream& ostr, const AsyncRecord& r,
+                         const FmtInfo& fmt, const char* fallback)
+{
+    if (r.flags & ASYNC_FLOAT) {
+        uint32_t bits = r.bits;
+        float val;
+        std::memcpy(&val, &bits, sizeof(val));
+        print_float10(ostr, r.flags & ~ASYNC_FLOAT, r.width, r.prec, fmt, val,
+                      fallback);
+    } else {
+        double val;
+        std::memcpy(&val, &r.bits, sizeof(val));
+        print_float10(ostr, r.flags, r.width, r.prec, fmt, val, fallback);
+    }
+    if (r.sep) {
+        ostr.put(r.sep);
+    }
+}
+
+static bool pop_record(AsyncFormatter::State& s, AsyncRecord& rec)
+{
+    AsyncSlot& slot = s.slots[s.tail & s.mask];
+    if (slot.seq.load(std::memory_order_acquire) != s.tail + 1) {
+        return false;
+    }
+    rec = slot.rec;
+    slot.seq.store(s.tail + s.mask + 1, std::memory_order_release);
+    s.tail++;
+    return true;
+}
+
+static void consumer_loop(AsyncFormatter::State& s)
+{
+    std::unique_ptr<char[]> buf(new char[ASYNC_BUF_SIZE]);
+    char* buf_end = buf.get() + ASYNC_BUF_SIZE;
+
+    // The fallback of the last record, usually all records share it
+    unsigned fb_flags = 0;
+    int fb_width = -2, fb_prec = -2;
+    char fallback[48];
+
+    unsigned idle = 0;
+    for (;;) {
+        char* out = buf.get();
+        unsigned count = 0;
+        AsyncRecord rec;
+        while (count < ASYNC_BATCH_SIZE && pop_record(s, rec)) {
+            count++;
+            unsigned flags = rec.flags & ~ASYNC_FLOAT;
+            if (flags != fb_flags || rec.width != fb_width ||
+                    rec.prec != fb_prec) {
+                cformat_detail::make_printf_fmt(fallback, sizeof(fallback),
+                                                flags, rec.width, rec.prec);
+                fb_flags = flags;
+                fb_width = rec.width;
+                fb_prec = rec.prec;
+            }
+            const FmtInfo& fmt = s.fmts[rec.fmt_id];
+
+            char* next = format_record(rec, fmt, fallback, out, buf_end);
+            if (!next) {
+                {
+                    std::lock_guard<std::mutex> lock(s.ostr_mutex);
+                    s.ostr->write(buf.get(), out - buf.get());
+                }
+                out = buf.get();
+                next = format_record(rec, fmt, fallback, out, buf_end);
+                if (!next) {
+                    std::lock_guard<std::mutex> lock(s.ostr_mutex);
+                    write_record(*s.ostr, rec, fmt, fallback);
+                    next = out;
+                }
+            }
+            out = next;
+        }
+
+        if (count > 0) {
+            {
+                std::lock_guard<std::mutex> lock(s.ostr_mutex);
+                s.ostr->write(buf.get(), out - buf.get());
+            }
+            s.written.store(s.tail, std::memory_order_release);
+            s.batches.fetch_add(1, std::memory_order_relaxed);
+            idle = 0;
+        }
+
+        uint64_t target = s.flush_target.load(std::memory_order_acquire);
+        // flush() flushes the stream itself once flushed reaches its target
+        if (target > s.flushed && s.tail >= target) {
+            std::lock_guard<std::mutex> lock(s.flush_mutex);
+            s.flushed = s.tail;
+            s.flush_cv.notify_all();
+        }
+
+        if (count == 0) {
+            if (s.stop.load(std::memory_order_acquire) &&
+                    s.head.load(std::memory_order_acquire) == s.tail) {
+                break;
+            }
+            if (++idle > ASYNC_IDLE_SPINS) {
+                std::this_thread::sleep_for(
+                        std::chrono::microseconds(ASYNC_IDLE_SLEEP_US));
+            }
+        }
+    }
+    std::lock_guard<std::mutex> lock(s.ostr_mutex);
+    s.ostr->flush();
+}
+
+AsyncFormatter::AsyncFormatter(std::ostream& ostr, unsigned capacity,
+                               Policy policy)
+{
+    unsigned size = 2;
+    while (size < capacity) {
+        size *= 2;
+    }
+
+    state_ = new State;
+    State& s = *state_;
+    s.head.store(0);
+    s.dropped.store(0);
+    s.written.store(0);
+    s.batches.store(0);
+    s.tail = 0;
+    s.slots = new AsyncSlot[size];
+    for (unsigned i = 0; i < size; ++i) {
+        s.slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+    s.mask = size - 1;
+    s.policy = policy;
+    s.ostr = &ostr;
+
+    // Unregistered ids use the C locale too
+    FmtInfo c_fmt = { '.', '\'', NULL, 0 };
+    std::fill_n(s.fmts, ASYNC_MAX_FMTS, c_fmt);
+    s.fmt_count.store(1);
+
+    s.stop.store(false);
+    s.flush_target.store(0);
+    s.flushed = 0;
+    s.thread = std::thread(consumer_loop, std::ref(s));
+}
+
+AsyncFormatter::~AsyncFormatter()
+{
+    state_->stop.store(true, std::memory_order_release);
+    state_->thread.join();
+    delete[] state_->slots;
+    delete state_;
+}
+
+unsigned AsyncFormatter::add_fmt(const FmtInfo& fmt)
+{
+    State& s = *state_;
+    std::lock_guard<std::mutex> lock(s.fmt_mutex);
+    unsigned id = s.fmt_count.load(std::memory_order_relaxed);
+    if (id >= ASYNC_MAX_FMTS) {
+        return 0;
+    }
+    // The entry is published to the consumer by the release store of the
+    // slot sequence in push()
+    s.fmts[id] = fmt;
+    s.fmt_count.store(id + 1, std::memory_order_relaxed);
+    return id;
+}
+
+static bool push_record(AsyncFormatter::State& s, const AsyncRecord& rec)
+{
+    uint64_t pos = s.head.load(std::memory_order_relaxed);
+    AsyncSlot* slot;
+    for (;;) {
+        slot = &s.slots[pos & s.mask];
+        uint64_t seq = slot->seq.load(std::memory_order_acquire);
+        int64_t diff = int64_t(seq - pos);
+        if (diff == 0) {
+            if (s.head.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // the ring buffer is full
+            if (s.policy == AsyncFormatter::ASYNC_DROP) {
+                s.dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            std::this_thread::yield();
+            pos = s.head.load(std::memory_order_relaxed);
+        } else {
+            // another producer claimed the slot
+            pos = s.head.load(std::memory_order_relaxed);
+        }
+    }
+    slot->rec = rec;
+    slot->seq.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+bool AsyncFormatter::push(unsigned flags, int width, int prec,
+                          unsigned fmt_id, float val, char sep)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &val, sizeof(val));
+    AsyncRecord rec = { bits, flags | ASYNC_FLOAT, width, prec,
+                        (unsigned char) fmt_id, sep };
+    return push_record(*state_, rec);
+}
+
+bool AsyncFormatter::push(unsigned flags, int width, int prec,
+                          unsigned fmt_id, double val, char sep)
+{
+    uint64_t bits;
+    std::memcpy(&bits, &val, sizeof(val));
+    AsyncRecord rec = { bits, flags, width, prec, (unsigned char) fmt_id, sep };
+    return push_record(*state_, rec);
+}
+
+void AsyncFormatter::flush()
+{
+    State& s = *state_;
+    uint64_t target = s.head.load(std::memory_order_acquire);
+    {
+        std::unique_lock<std::mutex> lock(s.flush_mutex);
+        uint64_t prev = s.flush_target.load(std::memory_order_relaxed);
+        while (prev < target &&
+               !s.flush_target.compare_exchange_weak(prev, target,
+                                                     std::memory_order_release)) {
+        }
+        while (s.flushed < target) {
+            s.flush_cv.wait(lock);
+        }
+    }
+    // Also when nothing was pending: the records may have been written by
+    // the consumer without a flush of the stream
+    std::lock_guard<std::mutex> lock(s.ostr_mutex);
+    s.ostr->flush();
+}
+
+AsyncFormatter::Stats AsyncFormatter::stats() const
+{
+    Stats st;
+    st.pushed = state_->head.load(std::memory_order_relaxed);
+    st.dropped = state_->dropped.load(std::memory_order_relaxed);
+    st.written = state_->written.load(std::memory_order_relaxed);
+    st.batches = state_->batches.load(std::memory_order_relaxed);
+    return st;
+}
@@ -0,0 +1,93 @@
+/*
+    Copyright (C) 2014  Povilas Kanapickas <povilas@radix.lt>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CFORMAT_ASYNC_H
+#define CFORMAT_ASYNC_H
+
+#include <iosfwd>
+#include "cformat.h"
+
+/** Deferred formatting for threads that can not afford to format values
+    themselves. push() stores the raw value and the formatting parameters in
+    a bounded lock-free ring buffer. A background thread takes the records in
+    batches, formats them with print_float10 into a buffer and writes each
+    batch to the output stream with a single write call.
+
+    Any number of threads may push concurrently. The stream must not be used
+    by anything else while the formatter exists.
+
+    The memory is bounded by the capacity given to the constructor. If the
+    ring buffer is full, push() either waits for the background thread
+    (ASYNC_BLOCK) or discards the value and returns false (ASYNC_DROP).
+
+    FmtInfo is referenced by an id returned by add_fmt(). Id 0 is the C
+    locale: '.' as the dot and no grouping. Since the printf fallback is
+    derived from the flags, width and precision, no fallback string is
+    needed.
+*/
+class AsyncFormatter {
+public:
+    enum Policy {
+        ASYNC_BLOCK,    // wait until the background thread frees a slot
+        ASYNC_DROP      // discard the value
+    };
+
+    struct Stats {
+        unsigned long long pushed;
+        unsigned long long dropped;
+        unsigned long long written;
+        unsigned long long batches;
+    };
+
+    /// capacity is rounded up to a power of two
+    AsyncFormatter(std::ostream& ostr, unsigned capacity = 65536,
+                   Policy policy = ASYNC_BLOCK);
+
+    /// Formats all pushed values, flushes the stream and stops the thread
+    ~AsyncFormatter();
+
+    /** Registers a FmtInfo and returns its id. The groups array must outlive
+        the formatter. At most 256 FmtInfo can be registered, 0 is returned
+        once the limit is reached.
+    */
+    unsigned add_fmt(const FmtInfo& fmt);
+
+    /** Queues a value to be formatted, followed by @a sep if it is not zero.
+        Returns false if the value has been dropped.
+    */
+    bool push(unsigned flags, int width, int prec, unsigned fmt_id, float val,
+              char sep = '\n');
+    bool push(unsigned flags, int width, int prec, unsigned fmt_id, double val,
+              char sep = '\n');
+
+    /** Waits until all values pushed before the call have been written and
+        flushes the stream.
+    */
+    void flush();
+
+    Stats stats() const;
+
+    struct State;
+
+private:
+    AsyncFormatter(const AsyncFormatter&);
+    AsyncFormatter& operator=(const AsyncFormatter&);
+
+    State* state_;
+};
+
+#endif
@@ -0,0 +1,2495 @@
+/*
+    Copyright (C) 2011-2014  Povilas Kanapickas <povilas@radix.lt>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CFORMAT_IMPL_H
+#define CFORMAT_IMPL_H
+
+/*  Implementation of the formatter. This header is internal: it is included by
+    cformat.cc, which provides the out-of-line functions declared in cformat.h,
+    and by cformat_inline.h, which provides the same functions as inline ones.
+    Everything here is in namespace cformat_detail and may change at any time.
+
+    All functions are inline or templates and all tables are inline constexpr,
+    so that the header may be included by any number of translation units.
+*/
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <cstring>
+#include <iostream>
+#include <cstdio>
+#include <cmath>
+#include <stdint.h>
+
+#include "cformat.h"
+#include "cformat_prof.h"
+
+/*  The functions from print_float10_sink down to the digit generation are
+    marked CF_FORMAT_INLINE. It expands to plain inline unless it is defined
+    before this header is included. cformat_inline.h defines it to force the
+    inlining, otherwise the compiler keeps print_float10_impl out of line
+    because of its size and the constant arguments of the caller are lost.
+*/
+#ifndef CF_FORMAT_INLINE
+#define CF_FORMAT_INLINE inline
+#endif
+
+namespace cformat_detail {
+
+inline void fill_impl(std::ostream& out, unsigned count,
+                      const char* spbuf, unsigned spbuf_len)
+{
+    while (count > spbuf_len) {
+        out.write(spbuf, spbuf_len);
+        count -= spbuf_len;
+    }
+    out.write(spbuf, count);
+}
+
+inline constexpr const char* fill_spaces_spbuf =
+        "                                        "
+        "                                        "
+        "                                        "
+        "                                        "
+        "                                        ";
+
+inline constexpr const char* fill_zeros_spbuf =
+        "0000000000000000000000000000000000000000"
+        "0000000000000000000000000000000000000000"
+        "0000000000000000000000000000000000000000"
+        "0000000000000000000000000000000000000000"
+        "0000000000000000000000000000000000000000";
+
+inline void fill_spaces(std::ostream& out, unsigned count)
+{
+    fill_impl(out, count, fill_spaces_spbuf, 200);
+}
+
+inline void fill_zeros(std::ostream& out, unsigned count)
+{
+    fill_impl(out, count, fill_zeros_spbuf, 200);
+}
+
+/*  The formatter writes its output to a sink. A sink provides the following
+    member functions:
+
+     * put(c) - writes a single character
+     * write(s, n) - writes n characters
+     * fill_spaces(n), fill_zeros(n) - writes n spaces or zeros respectively
+*/
+
+/// Sink that writes to a std::ostream
+struct StreamSink {
+    std::ostream& ostr;
+
+    StreamSink(std::ostream& o) : ostr(o) {}
+
+    void put(char c)                       { ostr.put(c); }
+    void write(const char* s, unsigned n)  { ostr.write(s, n); }
+    void fill_spaces(unsigned n)           { cformat_detail::fill_spaces(ostr, n); }
+    void fill_zeros(unsigned n)            { cformat_detail::fill_zeros(ostr, n); }
+};
+
+/** Sink that writes to a [out, last) character range. If the range is too
+    small, overflow is set and the output that does not fit is discarded.
+*/
+struct BufferSink {
+    char* out;
+    char* last;
+    bool overflow;
+
+    BufferSink(char* first, char* l) : out(first), last(l), overflow(false) {}
+
+    bool reserve(unsigned n)
+    {
+        if (overflow || unsigned(last - out) < n) {
+            overflow = true;
+            return false;
+        }
+        return true;
+    }
+
+    void put(char c)
+    {
+        if (reserve(1)) {
+            *out++ = c;
+        }
+    }
+
+    void write(const char* s, unsigned n)
+    {
+        if (reserve(n)) {
+            std::memcpy(out, s, n);
+            out += n;
+        }
+    }
+
+    void fill_spaces(unsigned n)
+    {
+        if (reserve(n)) {
+            out = std::fill_n(out, n, ' ');
+        }
+    }
+
+    void fill_zeros(unsigned n)
+    {
+        if (reserve(n)) {
+            out = std::fill_n(out, n, '0');
+        }
+    }
+};
+
+/*  Sinks for wider character types. The formatter produces ASCII, thus each
+    character is widened by a plain conversion as it is stored. A decimal dot
+    that does not fit into char is passed through the formatter as
+    WIDE_DOT_PLACEHOLDER and replaced when stored.
+*/
+inline constexpr char WIDE_DOT_PLACEHOLDER = '\x01';
+
+template<class CharT>
+inline CharT widen_char(char c, CharT dot)
+{
+    return (c == WIDE_DOT_PLACEHOLDER) ? dot : CharT((unsigned char) c);
+}
+
+/// Sink that writes to a std::basic_ostream<CharT>
+template<class CharT>
+struct WideStreamSink {
+    std::basic_ostream<CharT>& ostr;
+    CharT dot;
+
+    WideStreamSink(std::basic_ostream<CharT>& o, CharT d) : ostr(o), dot(d) {}
+
+    void put(char c) { ostr.put(widen_char(c, dot)); }
+
+    void write(const char* s, unsigned n)
+    {
+        // The stream interface needs contiguous CharT, widen in chunks
+        CharT buf[64];
+        while (n > 0) {
+            unsigned len = std::min(n, unsigned(sizeof(buf)/sizeof(*buf)));
+            for (unsigned i = 0; i < len; ++i) {
+                buf[i] = widen_char(s[i], dot);
+            }
+            ostr.write(buf, len);
+            s += len;
+            n -= len;
+        }
+    }
+
+    void fill(unsigned n, CharT c)
+    {
+        CharT buf[64];
+        std::fill_n(buf, std::min(n, unsigned(sizeof(buf)/sizeof(*buf))), c);
+        while (n > 0) {
+            unsigned len = std::min(n, unsigned(sizeof(buf)/sizeof(*buf)));
+            ostr.write(buf, len);
+            n -= len;
+        }
+    }
+
+    void fill_spaces(unsigned n)           { fill(n, CharT(' ')); }
+    void fill_zeros(unsigned n)            { fill(n, CharT('0')); }
+};
+
+/// Same as BufferSink, for a [out, last) range of CharT
+template<class CharT>
+struct WideBufferSink {
+    CharT* out;
+    CharT* last;
+    bool overflow;
+    CharT dot;
+
+    WideBufferSink(CharT* first, CharT* l, CharT d) :
+        out(first), last(l), overflow(false), dot(d) {}
+
+    bool reserve(unsigned n)
+    {
+        if (overflow || unsigned(last - out) < n) {
+            overflow = true;
+            return false;
+        }
+        return true;
+    }
+
+    void put(char c)
+    {
+        if (reserve(1)) {
+            *out++ = widen_char(c, dot);
+        }
+    }
+
+    void write(const char* s, unsigned n)
+    {
+        if (reserve(n)) {
+            for (unsigned i = 0; i < n; ++i) {
+                *out++ = widen_char(s[i], dot);
+            }
+        }
+    }
+
+    void fill_spaces(unsigned n)
+    {
+        if (reserve(n)) {
+            out = std::fill_n(out, n, CharT(' '));
+        }
+    }
+
+    void fill_zeros(unsigned n)
+    {
+        if (reserve(n)) {
+            out = std::fill_n(out, n, CharT('0'));
+        }
+    }
+};
+
+enum FloatFlags {
+    FLOAT_NONE = 0,
+    FLOAT_NEG = 1 << 0,         // negative
+    FLOAT_NAN = 1 << 1,         // not a number
+    FLOAT_INF = 1 << 2,         // positive or negative infinity
+    FLOAT_ZERO = 1 << 3,        // positive or negative zero
+};
+
+#define USE_INT128 0
+
+struct Uint96 {
+    uint64_t hi;
+    uint32_t lo;
+};
+
+// Division is performed by multiplication. The partial products below the
+// result are truncated, thus the result is never larger than the exact value
+// and is smaller by less than MULHI_ERR units of the last place (ulp).
+
+inline unsigned mulhi_err(uint64_t) { return 3; }
+
+#if USE_INT128
+inline uint64_t mulhi(uint64_t a, uint64_t b)
+{
+    return ((unsigned __int128)(a) * b) >> 64;
+}
+#else
+inline uint64_t mulhi(uint64_t a, uint64_t b)
+{
+    uint32_t ah, al, bh, bl;
+    ah = a >> 32;
+    al = a & 0xffffffff;
+    bh = b >> 32;
+    bl = b & 0xffffffff;
+    uint64_t r;
+    //uint32_t l;
+
+    r = uint64_t(ah) * bh;
+    r += (uint64_t(bh) * al) >> 32;
+    r += (uint64_t(bl) * ah) >> 32;
+    return r;
+}
+#endif
+
+inline unsigned mulhi_err(Uint96) { return 6; }
+
+#if USE_INT128
+inline Uint96 mulhi(Uint96 a, Uint96 b)
+{
+    uint64_t rh, rl;
+    rh = ((unsigned __int128)(a.hi) * b.hi) >> 64;
+    rl = ((unsigned __int128)(a.hi) * b.hi);
+
+    uint64_t ah32, bh32;
+    ah32 = a.hi >> 32;
+    bh32 = b.hi >> 32;
+    rl += (uint64_t(ah32) * b.lo);
+    rl += (uint64_t(bh32) * a.lo);
+    rl >>= 32;
+    a.hi = rh;
+    a.lo = rl;
+}
+#else
+inline Uint96 mulhi(Uint96 a, Uint96 b)
+{
+    /*        a1a2a3
+            * b1b2b3
+        r1r2r3
+        a1b1
+          a1b2
+            a1b3
+          a2b1
+            a2b2
+            a3b1
+
+    */
+    uint32_t a1, a2, a3;
+    uint32_t b1, b2, b3;
+    a1 = a.hi >> 32;
+    a2 = a.hi & 0xffffffff;
+    a3 = a.lo;
+    b1 = b.hi >> 32;
+    b2 = b.hi & 0xffffffff;
+    b3 = b.lo;
+    uint64_t rh, rl, i1, i2;
+    rh = uint64_t(a1) * b1;
+    i1 = uint64_t(a1) * b2;
+    i2 = uint64_t(a2) * b1;
+    rh += i1 >> 32;
+    rh += i2 >> 32;
+    rl = i1 & 0xffffffff;
+    rl += i2 & 0xffffffff;
+    rl += (uint64_t(a1) * b3) >> 32;
+    rl += (uint64_t(a2) * b2) >> 32;
+    rl += (uint64_t(a3) * b1) >> 32;
+    rh += rl >> 32;
+    rl &= 0xffffffff;
+    a.hi = rh;
+    a.lo = rl;
+    return a;
+}
+#endif
+
+/** Multiplier 2^exp2/5^exp5 (mul2div5_desc) or 5^exp5/2^exp2 (mul5div2_desc)
+    as a 96-bit fraction in cf1:cf2. The constants are truncated, i.e. less
+    than the exact value by less than one ulp. This holds for cf1 alone too.
+*/
+struct DivDesc {
+    unsigned exp2;
+    unsigned exp5;
+    uint64_t cf1;
+    uint32_t cf2;
+};
+
+/*  Multiplies d by the constant in desc. If d is less than the exact value x
+    by at most err ulp, the result is less than the exact x*constant by at most
+    err + muldiv_err(d) ulp: the error of d is scaled by a factor less than 1,
+    the error of the constant by x which is less than 1 and the product is
+    truncated.
+*/
+inline unsigned muldiv_err(uint64_t d) { return mulhi_err(d) + 1; }
+inline unsigned muldiv_err(Uint96 d)   { return mulhi_err(d) + 1; }
+
+inline uint64_t muldiv(uint64_t d, const DivDesc& desc)
+{
+    return mulhi(d, desc.cf1);
+}
+inline Uint96 muldiv(Uint96 d, const DivDesc& desc)
+{
+    Uint96 c; c.hi = desc.cf1; c.lo = desc.cf2;
+    return mulhi(d, c);
+}
+
+inline uint64_t mul(uint64_t d, unsigned i)
+{
+    return d*i;
+}
+
+inline Uint96 mul(Uint96 d, unsigned i)
+{
+    uint64_t rl, rh;
+    rl = uint64_t(d.lo) * i;
+    rh = d.hi * i;
+    rh += rl >> 32;
+    rl &= 0xffffffff;
+    d.hi = rh;
+    d.lo = rl;
+    return d;
+}
+
+/** 10^k as a 128-bit fraction in hi:lo, scaled to [2^127, 2^128) and rounded
+    up: floor(10^k * 2^(127 - floor(log2(10^k)))) + 1. hi + 1 is the same
+    constant rounded up to 64 bits. Used by the shortest formatting of
+    cf::to_chars.
+*/
+struct Pow10Desc {
+    uint64_t hi;
+    uint64_t lo;
+};
+
+/*  The tables mul2div5_desc and mul5div2_desc for positive and negative
+    binary exponents. Each is ordered by decreasing exp2 + exp5, the last
+    entries are {2, 1} and {3, 1} respectively. The constants are in [0.5, 1).
+    The tables are generated by gentables, which picks the set of steps that
+    is fastest on the build machine, see gentables.cc. shortest_pow10_desc
+    holds the entries of Pow10Desc from 10^shortest_pow10_min on.
+*/
+#include "cformat_tables.h"
+
+// shift - at most 32 bits
+inline uint64_t shift_r(uint64_t d, unsigned i) { return d >> i; }
+inline uint64_t shift_l(uint64_t d, unsigned i) { return d << i; }
+inline Uint96 shift_r(Uint96 d, unsigned i)
+{
+    d.lo >>= i;
+    d.lo |= uint32_t(d.hi & 0xffffffff) << 32-i;
+    d.hi >>= i;
+    return d;
+}
+inline Uint96 shift_l(Uint96 d, unsigned i)
+{
+    d.hi <<= i;
+    d.hi |= d.lo >> 32-i;
+    d.lo <<= i;
+    return d;
+}
+
+/*  IEEE754 32-bit float
+    1 bit: sign
+    8 bits: exponent
+    23 bits: significand (24th bit is implicitly set, but only if the number is
+        not denormal
+
+    IEEE754 64-bit float
+    1 bit: sign
+    11 bits: exponent
+    52 bits: significand (53th bit is implicitly set, but only if the number is
+        not denormal
+
+    The function sets @a signif and @a exp only if the number not infinity or
+    NaN. For zero, signif and exp are set to zero.
+
+    Significand is set in such a way that the (implicit) MSB of the significand
+    is shifted to the most significand position of signif. Denormal numbers are
+    normalized the same way.
+*/
+inline void decompose(float f, unsigned& fltflags, uint64_t& signif, int& exp)
+{
+    uint32_t fi;
+    std::memcpy(&fi, &f, sizeof(f));
+    fltflags = ((fi >> 31) == 1) ? FLOAT_NEG : FLOAT_NONE;
+    fi &= 0x7fffffff;
+    exp = fi >> 23;
+    if (exp == 0xff) {
+        fltflags |= (fi & 0x007fffff) ? FLOAT_NAN : FLOAT_INF;
+        return;
+    }
+    if (exp == 0) {
+        if (fi == 0) {
+            fltflags |= FLOAT_ZERO;
+            signif = 0;
+            return;
+        }
+        // denormal
+        unsigned shift = __builtin_clz(fi) - 8;
+        signif = ((uint64_t) fi) << 8+32+shift;
+        exp = -126 - shift;
+        return;
+    }
+    signif = ((uint64_t) (fi | 0x00800000)) << 8+32;
+    exp -= 127;
+}
+
+inline void decompose(double f, unsigned& fltflags, Uint96& signif, int& exp)
+{
+    uint64_t fi;
+    std::memcpy(&fi, &f, sizeof(f));
+    fltflags = ((fi >> 63) == 1) ? FLOAT_NEG : FLOAT_NONE;
+    fi &= 0x7fffffffffffffff;
+    exp = fi >> 52;
+    if (exp == 0x7ff) {
+        fltflags |= (fi & 0x000fffffffffffff) ? FLOAT_NAN : FLOAT_INF;
+        return;
+    }
+    signif.lo = 0;
+    if (exp == 0) {
+        if (fi == 0) {
+            fltflags |= FLOAT_ZERO;
+            signif.hi = 0;
+            return;
+        }
+        // denormal
+        unsigned shift = __builtin_clzll(fi);
+        signif.hi = fi << shift;
+        exp = -1011 - shift;
+        return;
+    }
+    signif.hi = (fi | 0x0010000000000000) << 11;
+    exp -= 1023;
+}
+
+/*  IEEE754 16-bit float (binary16)
+    1 bit: sign
+    5 bits: exponent
+    10 bits: significand
+
+    bfloat16, the upper half of the 32-bit float
+    1 bit: sign
+    8 bits: exponent
+    7 bits: significand
+
+    Same as decompose() for float. Since the significands have at most 11 bits,
+    the result is exact in uint64_t.
+*/
+inline void decompose(Float16 f, unsigned& fltflags, uint64_t& signif, int& exp)
+{
+    uint32_t fi = f.bits;
+    fltflags = ((fi >> 15) == 1) ? FLOAT_NEG : FLOAT_NONE;
+    fi &= 0x7fff;
+    exp = fi >> 10;
+    if (exp == 0x1f) {
+        fltflags |= (fi & 0x03ff) ? FLOAT_NAN : FLOAT_INF;
+        return;
+    }
+    if (exp == 0) {
+        if (fi == 0) {
+            fltflags |= FLOAT_ZERO;
+            signif = 0;
+            return;
+        }
+        // denormal
+        unsigned shift = __builtin_clz(fi) - 21;
+        signif = ((uint64_t) fi) << 53+shift;
+        exp = -14 - shift;
+        return;
+    }
+    signif = ((uint64_t) ((fi & 0x03ff) | 0x0400)) << 53;
+    exp -= 15;
+}
+
+inline void decompose(BFloat16 f, unsigned& fltflags, uint64_t& signif, int& exp)
+{
+    uint32_t fi = f.bits;
+    fltflags = ((fi >> 15) == 1) ? FLOAT_NEG : FLOAT_NONE;
+    fi &= 0x7fff;
+    exp = fi >> 7;
+    if (exp == 0xff) {
+        fltflags |= (fi & 0x007f) ? FLOAT_NAN : FLOAT_INF;
+        return;
+    }
+    if (exp == 0) {
+        if (fi == 0) {
+            fltflags |= FLOAT_ZERO;
+            signif = 0;
+            return;
+        }
+        // denormal
+        unsigned shift = __builtin_clz(fi) - 24;
+        signif = ((uint64_t) fi) << 56+shift;
+        exp = -126 - shift;
+        return;
+    }
+    signif = ((uint64_t) ((fi & 0x007f) | 0x0080)) << 56;
+    exp -= 127;
+}
+
+inline float half_to_float(Float16 val)
+{
+    uint32_t sign = uint32_t(val.bits & 0x8000) << 16;
+    uint32_t exp = (val.bits >> 10) & 0x1f;
+    uint32_t frac = val.bits & 0x03ff;
+    uint32_t fi;
+    if (exp == 0x1f) {
+        fi = sign | 0x7f800000 | (frac << 13);
+    } else if (exp == 0) {
+        if (frac == 0) {
+            fi = sign;
+        } else {
+            // denormal, normal as a float
+            unsigned shift = __builtin_clz(frac) - 21;
+            frac = (frac << shift) & 0x03ff;
+            fi = sign | ((113 - shift) << 23) | (frac << 13);
+        }
+    } else {
+        fi = sign | ((exp + 112) << 23) | (frac << 13);
+    }
+    float res;
+    std::memcpy(&res, &fi, sizeof(res));
+    return res;
+}
+
+inline float half_to_float(BFloat16 val)
+{
+    uint32_t fi = uint32_t(val.bits) << 16;
+    float res;
+    std::memcpy(&res, &fi, sizeof(res));
+    return res;
+}
+
+/** Multiplier 2^exp/10^exp10 for each binary exponent of the 16-bit types, as
+    a truncated 64-bit fraction. exp10 is chosen so that the multiplier is
+    within [0.1, 1). The first entry is for the exponent of the smallest
+    denormal: -24 for Float16 and -133 for BFloat16.
+
+    The range reduction is thus a single multiplication instead of the loops
+    over mul2div5_desc and mul5div2_desc.
+*/
+struct PowDesc {
+    uint64_t cf;
+    int exp10;
+};
+
+inline constexpr int float16_min_exp = -24;
+inline constexpr int bfloat16_min_exp = -133;
+
+inline constexpr PowDesc float16_pow_desc[] = {
+    { 0x9896800000000000,   -7 }, { 0x1e84800000000000,   -6 },
+    { 0x3d09000000000000,   -6 }, { 0x7a12000000000000,   -6 },
+    { 0xf424000000000000,   -6 }, { 0x30d4000000000000,   -5 },
+    { 0x61a8000000000000,   -5 }, { 0xc350000000000000,   -5 },
+    { 0x2710000000000000,   -4 }, { 0x4e20000000000000,   -4 },
+    { 0x9c40000000000000,   -4 }, { 0x1f40000000000000,   -3 },
+    { 0x3e80000000000000,   -3 }, { 0x7d00000000000000,   -3 },
+    { 0xfa00000000000000,   -3 }, { 0x3200000000000000,   -2 },
+    { 0x6400000000000000,   -2 }, { 0xc800000000000000,   -2 },
+    { 0x2800000000000000,   -1 }, { 0x5000000000000000,   -1 },
+    { 0xa000000000000000,   -1 }, { 0x2000000000000000,    0 },
+    { 0x4000000000000000,    0 }, { 0x8000000000000000,    0 },
+    { 0x1999999999999999,    1 }, { 0x3333333333333333,    1 },
+    { 0x6666666666666666,    1 }, { 0xcccccccccccccccc,    1 },
+    { 0x28f5c28f5c28f5c2,    2 }, { 0x51eb851eb851eb85,    2 },
+    { 0xa3d70a3d70a3d70a,    2 }, { 0x20c49ba5e353f7ce,    3 },
+    { 0x4189374bc6a7ef9d,    3 }, { 0x83126e978d4fdf3b,    3 },
+    { 0x1a36e2eb1c432ca5,    4 }, { 0x346dc5d63886594a,    4 },
+    { 0x68db8bac710cb295,    4 }, { 0xd1b71758e219652b,    4 },
+    { 0x29f16b11c6d1e108,    5 }, { 0x53e2d6238da3c211,    5 },
+};
+
+inline constexpr PowDesc bfloat16_pow_desc[] = {
+    { 0xeb194f8e1ae525fd,  -40 }, { 0x2f050fe938943acc,  -39 },
+    { 0x5e0a1fd271287598,  -39 }, { 0xbc143fa4e250eb31,  -39 },
+    { 0x259da6542d43623d,  -38 }, { 0x4b3b4ca85a86c47a,  -38 },
+    { 0x96769950b50d88f4,  -38 }, { 0x1e17b84357691b64,  -37 },
+    { 0x3c2f7086aed236c8,  -37 }, { 0x785ee10d5da46d90,  -37 },
+    { 0xf0bdc21abb48db20,  -37 }, { 0x3025f39ef241c56c,  -36 },
+    { 0x604be73de4838ad9,  -36 }, { 0xc097ce7bc90715b3,  -36 },
+    { 0x2684c2e58e9b0457,  -35 }, { 0x4d0985cb1d3608ae,  -35 },
+    { 0x9a130b963a6c115c,  -35 }, { 0x1ed09bead87c0378,  -34 },
+    { 0x3da137d5b0f806f1,  -34 }, { 0x7b426fab61f00de3,  -34 },
+    { 0xf684df56c3e01bc6,  -34 }, { 0x314dc6448d9338c1,  -33 },
+    { 0x629b8c891b267182,  -33 }, { 0xc5371912364ce305,  -33 },
+    { 0x27716b6a0adc2d67,  -32 }, { 0x4ee2d6d415b85ace,  -32 },
+    { 0x9dc5ada82b70b59d,  -32 }, { 0x1f8def8808b02452,  -31 },
+    { 0x3f1bdf10116048a5,  -31 }, { 0x7e37be2022c0914b,  -31 },
+    { 0xfc6f7c4045812296,  -31 }, { 0x327cb2734119d3b7,  -30 },
+    { 0x64f964e68233a76f,  -30 }, { 0xc9f2c9cd04674ede,  -30 },
+    { 0x2863c1f5cdae42f9,  -29 }, { 0x50c783eb9b5c85f2,  -29 },
+    { 0xa18f07d736b90be5,  -29 }, { 0x204fce5e3e250261,  -28 },
+    { 0x409f9cbc7c4a04c2,  -28 }, { 0x813f3978f8940984,  -28 },
+    { 0x19d971e4fe8401e7,  -27 }, { 0x33b2e3c9fd0803ce,  -27 },
+    { 0x6765c793fa10079d,  -27 }, { 0xcecb8f27f4200f3a,  -27 },
+    { 0x295be96e64066972,  -26 }, { 0x52b7d2dcc80cd2e4,  -26 },
+    { 0xa56fa5b99019a5c8,  -26 }, { 0x2116545850052128,  -25 },
+    { 0x422ca8b0a00a4250,  -25 }, { 0x84595161401484a0,  -25 },
+    { 0x1a784379d99db420,  -24 }, { 0x34f086f3b33b6840,  -24 },
+    { 0x69e10de76676d080,  -24 }, { 0xd3c21bcecceda100,  -24 },
+    { 0x2a5a058fc295ed00,  -23 }, { 0x54b40b1f852bda00,  -23 },
+    { 0xa968163f0a57b400,  -23 }, { 0x21e19e0c9bab2400,  -22 },
+    { 0x43c33c1937564800,  -22 }, { 0x878678326eac9000,  -22 },
+    { 0x1b1ae4d6e2ef5000,  -21 }, { 0x3635c9adc5dea000,  -21 },
+    { 0x6c6b935b8bbd4000,  -21 }, { 0xd8d726b7177a8000,  -21 },
+    { 0x2b5e3af16b188000,  -20 }, { 0x56bc75e2d6310000,  -20 },
+    { 0xad78ebc5ac620000,  -20 }, { 0x22b1c8c1227a0000,  -19 },
+    { 0x4563918244f40000,  -19 }, { 0x8ac7230489e80000,  -19 },
+    { 0x1bc16d674ec80000,  -18 }, { 0x3782dace9d900000,  -18 },
+    { 0x6f05b59d3b200000,  -18 }, { 0xde0b6b3a76400000,  -18 },
+    { 0x2c68af0bb1400000,  -17 }, { 0x58d15e1762800000,  -17 },
+    { 0xb1a2bc2ec5000000,  -17 }, { 0x2386f26fc1000000,  -16 },
+    { 0x470de4df82000000,  -16 }, { 0x8e1bc9bf04000000,  -16 },
+    { 0x1c6bf52634000000,  -15 }, { 0x38d7ea4c68000000,  -15 },
+    { 0x71afd498d0000000,  -15 }, { 0xe35fa931a0000000,  -15 },
+    { 0x2d79883d20000000,  -14 }, { 0x5af3107a40000000,  -14 },
+    { 0xb5e620f480000000,  -14 }, { 0x246139ca80000000,  -13 },
+    { 0x48c2739500000000,  -13 }, { 0x9184e72a00000000,  -13 },
+    { 0x1d1a94a200000000,  -12 }, { 0x3a35294400000000,  -12 },
+    { 0x746a528800000000,  -12 }, { 0xe8d4a51000000000,  -12 },
+    { 0x2e90edd000000000,  -11 }, { 0x5d21dba000000000,  -11 },
+    { 0xba43b74000000000,  -11 }, { 0x2540be4000000000,  -10 },
+    { 0x4a817c8000000000,  -10 }, { 0x9502f90000000000,  -10 },
+    { 0x1dcd650000000000,   -9 }, { 0x3b9aca0000000000,   -9 },
+    { 0x7735940000000000,   -9 }, { 0xee6b280000000000,   -9 },
+    { 0x2faf080000000000,   -8 }, { 0x5f5e100000000000,   -8 },
+    { 0xbebc200000000000,   -8 }, { 0x2625a00000000000,   -7 },
+    { 0x4c4b400000000000,   -7 }, { 0x9896800000000000,   -7 },
+    { 0x1e84800000000000,   -6 }, { 0x3d09000000000000,   -6 },
+    { 0x7a12000000000000,   -6 }, { 0xf424000000000000,   -6 },
+    { 0x30d4000000000000,   -5 }, { 0x61a8000000000000,   -5 },
+    { 0xc350000000000000,   -5 }, { 0x2710000000000000,   -4 },
+    { 0x4e20000000000000,   -4 }, { 0x9c40000000000000,   -4 },
+    { 0x1f40000000000000,   -3 }, { 0x3e80000000000000,   -3 },
+    { 0x7d00000000000000,   -3 }, { 0xfa00000000000000,   -3 },
+    { 0x3200000000000000,   -2 }, { 0x6400000000000000,   -2 },
+    { 0xc800000000000000,   -2 }, { 0x2800000000000000,   -1 },
+    { 0x5000000000000000,   -1 }, { 0xa000000000000000,   -1 },
+    { 0x2000000000000000,    0 }, { 0x4000000000000000,    0 },
+    { 0x8000000000000000,    0 }, { 0x1999999999999999,    1 },
+    { 0x3333333333333333,    1 }, { 0x6666666666666666,    1 },
+    { 0xcccccccccccccccc,    1 }, { 0x28f5c28f5c28f5c2,    2 },
+    { 0x51eb851eb851eb85,    2 }, { 0xa3d70a3d70a3d70a,    2 },
+    { 0x20c49ba5e353f7ce,    3 }, { 0x4189374bc6a7ef9d,    3 },
+    { 0x83126e978d4fdf3b,    3 }, { 0x1a36e2eb1c432ca5,    4 },
+    { 0x346dc5d63886594a,    4 }, { 0x68db8bac710cb295,    4 },
+    { 0xd1b71758e219652b,    4 }, { 0x29f16b11c6d1e108,    5 },
+    { 0x53e2d6238da3c211,    5 }, { 0xa7c5ac471b478423,    5 },
+    { 0x218def416bdb1a6d,    6 }, { 0x431bde82d7b634da,    6 },
+    { 0x8637bd05af6c69b5,    6 }, { 0x1ad7f29abcaf4857,    7 },
+    { 0x35afe535795e90af,    7 }, { 0x6b5fca6af2bd215e,    7 },
+    { 0xd6bf94d5e57a42bc,    7 }, { 0x2af31dc4611873bf,    8 },
+    { 0x55e63b88c230e77e,    8 }, { 0xabcc77118461cefc,    8 },
+    { 0x225c17d04dad2965,    9 }, { 0x44b82fa09b5a52cb,    9 },
+    { 0x89705f4136b4a597,    9 }, { 0x1b7cdfd9d7bdbab7,   10 },
+    { 0x36f9bfb3af7b756f,   10 }, { 0x6df37f675ef6eadf,   10 },
+    { 0xdbe6fecebdedd5be,   10 }, { 0x2bfaffc2f2c92abf,   11 },
+    { 0x57f5ff85e592557f,   11 }, { 0xafebff0bcb24aafe,   11 },
+    { 0x232f33025bd42232,   12 }, { 0x465e6604b7a84465,   12 },
+    { 0x8cbccc096f5088cb,   12 }, { 0x1c25c268497681c2,   13 },
+    { 0x384b84d092ed0384,   13 }, { 0x709709a125da0709,   13 },
+    { 0xe12e13424bb40e13,   13 }, { 0x2d09370d42573603,   14 },
+    { 0x5a126e1a84ae6c07,   14 }, { 0xb424dc35095cd80f,   14 },
+    { 0x24075f3dceac2b36,   15 }, { 0x480ebe7b9d58566c,   15 },
+    { 0x901d7cf73ab0acd9,   15 }, { 0x1cd2b297d889bc2b,   16 },
+    { 0x39a5652fb1137856,   16 }, { 0x734aca5f6226f0ad,   16 },
+    { 0xe69594bec44de15b,   16 }, { 0x2e1dea8c8da92d12,   17 },
+    { 0x5c3bd5191b525a24,   17 }, { 0xb877aa3236a4b449,   17 },
+    { 0x24e4bba3a4875741,   18 }, { 0x49c97747490eae83,   18 },
+    { 0x9392ee8e921d5d07,   18 }, { 0x1d83c94fb6d2ac34,   19 },
+    { 0x3b07929f6da55869,   19 }, { 0x760f253edb4ab0d2,   19 },
+    { 0xec1e4a7db69561a5,   19 }, { 0x2f394219248446ba,   20 },
+    { 0x5e72843249088d75,   20 }, { 0xbce5086492111aea,   20 },
+    { 0x25c768141d369efb,   21 }, { 0x4b8ed0283a6d3df7,   21 },
+    { 0x971da05074da7bee,   21 }, { 0x1e392010175ee596,   22 },
+    { 0x3c7240202ebdcb2c,   22 }, { 0x78e480405d7b9658,   22 },
+    { 0xf1c90080baf72cb1,   22 }, { 0x305b66802564a289,   23 },
+    { 0x60b6cd004ac94513,   23 }, { 0xc16d9a0095928a27,   23 },
+    { 0x26af8533511d4ed4,   24 }, { 0x4d5f0a66a23a9da9,   24 },
+    { 0x9abe14cd44753b52,   24 }, { 0x1ef2d0f5da7dd8aa,   25 },
+    { 0x3de5a1ebb4fbb154,   25 }, { 0x7bcb43d769f762a8,   25 },
+    { 0xf79687aed3eec551,   25 }, { 0x318481895d962776,   26 },
+    { 0x63090312bb2c4eed,   26 }, { 0xc612062576589dda,   26 },
+    { 0x279d346de4781f92,   27 }, { 0x4f3a68dbc8f03f24,   27 },
+    { 0x9e74d1b791e07e48,   27 }, { 0x1fb0f6be50601941,   28 },
+    { 0x3f61ed7ca0c03283,   28 }, { 0x7ec3daf941806506,   28 },
+    { 0xfd87b5f28300ca0d,   28 }, { 0x32b4bdfd4d668ecf,   29 },
+    { 0x65697bfa9acd1d9f,   29 }, { 0xcad2f7f5359a3b3e,   29 },
+    { 0x289097fdd7853f0c,   30 }, { 0x51212ffbaf0a7e18,   30 },
+    { 0xa2425ff75e14fc31,   30 }, { 0x2073accb12d0ff3d,   31 },
+    { 0x40e7599625a1fe7a,   31 }, { 0x81ceb32c4b43fcf4,   31 },
+    { 0x19f623d5a8a73297,   32 }, { 0x33ec47ab514e652e,   32 },
+    { 0x67d88f56a29cca5d,   32 }, { 0xcfb11ead453994ba,   32 },
+    { 0x2989d2ef743eb758,   33 }, { 0x5313a5dee87d6eb0,   33 },
+    { 0xa6274bbdd0fadd61,   33 }, { 0x213b0f25f69892ad,   34 },
+    { 0x42761e4bed31255a,   34 }, { 0x84ec3c97da624ab4,   34 },
+    { 0x1a95a5b7f87a0ef0,   35 }, { 0x352b4b6ff0f41de1,   35 },
+    { 0x6a5696dfe1e83bc3,   35 }, { 0xd4ad2dbfc3d07787,   35 },
+    { 0x2a8909265a5ce4b4,   36 }, { 0x5512124cb4b9c969,   36 },
+    { 0xaa242499697392d2,   36 }, { 0x22073a8515171d5d,   37 },
+    { 0x440e750a2a2e3aba,   37 }, { 0x881cea14545c7575,   37 },
+    { 0x1b38fb9daa78e44a,   38 }, { 0x3671f73b54f1c895,   38 },
+    { 0x6ce3ee76a9e3912a,   38 }, { 0xd9c7dced53c72255,   38 },
+    { 0x2b8e5f62aa5b06dd,   39 },
+};
+
+inline const char* get_special(unsigned fltflags, unsigned flags)
+{
+    if (fltflags & FLOAT_NAN) {
+        if (flags & FLAG_UPPERCASE) {
+            return "NAN";
+        } else {
+            return "nan";
+        }
+    }
+    if (flags & FLAG_UPPERCASE) {
+        return "INF";
+    } else {
+        return "inf";
+    }
+}
+
+/** Writes the already formatted number [beg, end) to the sink, along with the
+    sign and padding as requested by @a flags and @a width. Zero padding is
+    inserted after the first @a prefix_len characters of the number.
+*/
+template<class Sink>
+inline void print_padded(Sink& sink, unsigned flags, int width,
+                         unsigned fltflags, const char* beg, const char* end,
+                         unsigned prefix_len = 0)
+{
+    char sign = 0;
+    if (fltflags & FLOAT_NEG) {
+        sign = '-';
+    } else if (flags & FLAG_SIGN) {
+        sign = '+';
+    } else if (flags & FLAG_SPACE) {
+        sign = ' ';
+    }
+
+    width -= (end - beg) + (sign ? 1 : 0);
+
+    if (flags & FLAG_LEFT) {
+        // left adjusted
+        if (sign) {
+            sink.put(sign);
+        }
+        sink.write(beg, end - beg);
+        if (width > 0) {
+            sink.fill_spaces(width);
+        }
+        return;
+    }
+
+    if (flags & FLAG_ZERO) {
+        // fill zeros between pre and data
+        if (sign) {
+            sink.put(sign);
+        }
+        sink.write(beg, prefix_len);
+        if (width > 0) {
+            sink.fill_zeros(width);
+        }
+        sink.write(beg + prefix_len, end - beg - prefix_len);
+        return;
+    }
+
+    // right adjusted
+    if (width > 0) {
+        sink.fill_spaces(width);
+    }
+    if (sign) {
+        sink.put(sign);
+    }
+    sink.write(beg, end - beg);
+}
+
+/// Prints infinity or NaN. Zero padding is not applied to these values.
+template<class Sink>
+inline void print_float_special(Sink& sink, unsigned flags, int width,
+                                unsigned fltflags)
+{
+    const char* sp = get_special(fltflags, flags);
+    print_padded(sink, flags & ~FLAG_ZERO, width, fltflags, sp, sp + 3);
+}
+
+
+
+/** We must keep as many significant digits in signif as possible at all times.
+    This function shifts signif by one position and updates the exponent in
+    case the msb of signif becomes zero.
+*/
+inline uint64_t renormalize_signif(uint64_t signif, int& exp)
+{
+    if (exp > 0) {
+        unsigned shift = (signif >> 63) ^ 1; // shift iff the top 4 bits are
+        signif <<= shift;
+        exp -= shift;
+    }
+    return signif;
+}
+
+inline Uint96 renormalize_signif(Uint96 signif, int& exp)
+{
+    if (exp > 0) {
+        unsigned shift = __builtin_clzll(signif.hi);
+        if (shift > 0) {
+            signif = shift_l(signif, shift);
+            exp -= shift;
+        }
+    }
+    return signif;
+}
+
+/** Same as renormalize_signif, except that exp is the negated exponent, i.e.
+    the number of times signif still needs to be divided by 2.
+*/
+inline uint64_t renormalize_signif_neg(uint64_t signif, int& exp)
+{
+    unsigned shift = (signif >> 63) ^ 1;
+    signif <<= shift;
+    exp += shift;
+    return signif;
+}
+
+inline Uint96 renormalize_signif_neg(Uint96 signif, int& exp)
+{
+    unsigned shift = __builtin_clzll(signif.hi);
+    if (shift > 0) {
+        signif = shift_l(signif, shift);
+        exp += shift;
+    }
+    return signif;
+}
+
+inline unsigned extract_signif_digit(uint64_t signif) { return signif >> 60; }
+inline uint64_t clear_signif_digit(uint64_t signif)   { return signif & ~0xf000000000000000; }
+inline unsigned extract_signif_digit(Uint96 signif) { return signif.hi >> 60; }
+inline Uint96 clear_signif_digit(Uint96 signif)     { signif.hi &= ~0xf000000000000000; return signif; }
+inline bool is_zero(uint64_t d) { return d == 0; }
+inline bool is_zero(Uint96 d) { return d.hi == 0 && d.lo == 0; }
+inline bool less(uint64_t a, uint64_t b) { return a < b; }
+inline bool less(Uint96 a, Uint96 b)
+{
+    return a.hi < b.hi || (a.hi == b.hi && a.lo < b.lo);
+}
+inline uint64_t add(uint64_t a, uint64_t b) { return a + b; }
+inline Uint96 add(Uint96 a, Uint96 b)
+{
+    uint64_t lo = uint64_t(a.lo) + b.lo;
+    a.hi += b.hi + (lo >> 32);
+    a.lo = lo;
+    return a;
+}
+inline uint64_t add(uint64_t a, unsigned ulp) { return a + ulp; }
+inline Uint96 add(Uint96 a, unsigned ulp)
+{
+    Uint96 b; b.hi = 0; b.lo = ulp;
+    return add(a, b);
+}
+/// Returns a value of the type of @a d whose top 4 bits are @a digit
+inline uint64_t make_signif_digit(uint64_t, unsigned digit)
+{
+    return uint64_t(digit) << 60;
+}
+inline Uint96 make_signif_digit(Uint96, unsigned digit)
+{
+    Uint96 r; r.hi = uint64_t(digit) << 60; r.lo = 0;
+    return r;
+}
+
+
+/// Extracts a digit and prepares the signif for next extraction
+template<class T>
+inline unsigned extract_update_signif_digit(T& signif)
+{
+    unsigned res = extract_signif_digit(signif);
+    signif = clear_signif_digit(signif);
+    signif = mul(signif, 10);
+    return res;
+}
+
+/** Multiplies the error bound by 10 along with the significand. Once the
+    error reaches a whole digit, it saturates at 15 digits which is more than
+    any remainder can be compared against.
+*/
+template<class T>
+inline T mul_err(T err)
+{
+    if (extract_signif_digit(err) != 0) {
+        return make_signif_digit(err, 15);
+    }
+    return mul(err, 10);
+}
+
+/** Returns the error bound of a significand after shift_r(signif, i). The
+    shift truncates, which adds less than one ulp. A significand that is
+    still exact is not affected: decompose() leaves at least 40 zero bits at
+    the bottom.
+*/
+template<class T>
+inline T shift_r_err(T err, unsigned i)
+{
+    if (is_zero(err)) {
+        return err;
+    }
+    return add(shift_r(err, i), 2u); // rounding of err up and the truncation
+}
+
+/// Same as extract_update_signif_digit, also updates the error bound @a err
+template<class T>
+inline unsigned extract_update_signif_digit(T& signif, T& err)
+{
+    err = mul_err(err);
+    return extract_update_signif_digit(signif);
+}
+
+/** Builds the printf format equivalent to the given flags, width and
+    precision, e.g. "%-12.3f", into @a buf of @a size characters. A negative
+    width or precision is omitted. The format is at most 31 characters long,
+    it is truncated if @a size is smaller than 32.
+*/
+inline void make_printf_fmt(char* buf, unsigned size, unsigned flags,
+                            int width, int prec)
+{
+    char tmp[32];
+    char* out = tmp;
+    *out++ = '%';
+    if (flags & FLAG_LEFT)  *out++ = '-';
+    if (flags & FLAG_SIGN)  *out++ = '+';
+    if (flags & FLAG_SPACE) *out++ = ' ';
+    if (flags & FLAG_ALT)   *out++ = '#';
+    if (flags & FLAG_ZERO)  *out++ = '0';
+    if (width >= 0) {
+        out = std::to_chars(out, out + 11, width).ptr;
+    }
+    if (prec >= 0) {
+        *out++ = '.';
+        out = std::to_chars(out, out + 11, prec).ptr;
+    }
+    char conv = 'g';
+    if (flags & FLAG_FLT_HEX) {
+        conv = 'a';
+    } else if (flags & FLAG_FLT_NOR) {
+        conv = 'f';
+    } else if (flags & FLAG_FLT_EXP) {
+        conv = 'e';
+    }
+    *out++ = (flags & FLAG_UPPERCASE) ? conv - 'a' + 'A' : conv;
+
+    if (size == 0) {
+        return;
+    }
+    unsigned len = std::min(unsigned(out - tmp), size - 1);
+    std::memcpy(buf, tmp, len);
+    buf[len] = '\0';
+}
+
+template<class Sink, class T>
+inline void print_sprintf(Sink& sink, T val, const char* fmt)
+{
+    char buf[1024];
+    int num = std::snprintf(buf, sizeof(buf), fmt, val);
+    if (num <= 0) {
+        return;
+    }
+    if (unsigned(num) < sizeof(buf)) {
+        sink.write(buf, num);
+        return;
+    }
+    // Long %f output of large values
+    std::string long_buf(num + 1, '\0');
+    std::snprintf(&long_buf[0], num + 1, fmt, val);
+    sink.write(long_buf.data(), num);
+}
+
+// The 16-bit values are passed to snprintf as floats
+template<class Sink>
+inline void print_sprintf(Sink& sink, Float16 val, const char* fmt)
+{
+    print_sprintf(sink, half_to_float(val), fmt);
+}
+template<class Sink>
+inline void print_sprintf(Sink& sink, BFloat16 val, const char* fmt)
+{
+    print_sprintf(sink, half_to_float(val), fmt);
+}
+
+inline constexpr char digit_pairs[] =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+
+/** Writes the decimal digits of @a n to the characters immediately preceding
+    @a end, at least @a min_digits of them. Returns the beginning of the
+    written digits.
+*/
+inline char* format_uint64_r(char* end, uint64_t n, unsigned min_digits)
+{
+    char* out = end;
+    while (n >= 100) {
+        unsigned d = (n % 100) * 2;
+        n /= 100;
+        *--out = digit_pairs[d + 1];
+        *--out = digit_pairs[d];
+    }
+    if (n >= 10) {
+        *--out = digit_pairs[n*2 + 1];
+        *--out = digit_pairs[n*2];
+    } else {
+        *--out = '0' + n;
+    }
+    while (unsigned(end - out) < min_digits) {
+        *--out = '0';
+    }
+    return out;
+}
+
+inline unsigned count_digits(uint64_t n)
+{
+    unsigned r = 1;
+    while (n >= 10) {
+        n /= 10;
+        r++;
+    }
+    return r;
+}
+
+inline constexpr uint64_t pow5_table[] = {
+    1ull, 5ull, 25ull, 125ull, 625ull, 3125ull, 15625ull, 78125ull, 390625ull,
+    1953125ull, 9765625ull, 48828125ull, 244140625ull, 1220703125ull,
+    6103515625ull, 30517578125ull, 152587890625ull, 762939453125ull,
+    3814697265625ull, 19073486328125ull, 95367431640625ull,
+    476837158203125ull, 2384185791015625ull, 11920928955078125ull,
+    59604644775390625ull, 298023223876953125ull, 1490116119384765625ull,
+    7450580596923828125ull
+};
+
+inline constexpr uint64_t pow10_table[] = {
+    1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull,
+    100000000ull, 1000000000ull, 10000000000ull, 100000000000ull,
+    1000000000000ull, 10000000000000ull, 100000000000000ull,
+    1000000000000000ull, 10000000000000000ull, 100000000000000000ull,
+    1000000000000000000ull, 10000000000000000000ull
+};
+
+/** Computes round(m * 2^e * 10^prec) using 64-bit integer arithmetic only.
+    The rounding is to nearest, ties to even, thus the result is exactly the
+    digit string %.<prec>f would produce, without the dot. Returns false if the
+    intermediate values do not fit into 64 bits.
+*/
+CF_FORMAT_INLINE
+bool scale_to_int(uint64_t m, int e, unsigned prec, uint64_t& res)
+{
+    if (prec >= sizeof(pow5_table)/sizeof(*pow5_table)) {
+        return false;
+    }
+    if (m == 0) {
+        res = 0;
+        return true;
+    }
+    // Small integers have many trailing zero bits, drop them so that the
+    // product is more likely to fit
+    unsigned tz = __builtin_ctzll(m);
+    m >>= tz;
+    e += tz;
+
+    // m * 2^e * 10^prec == m * 5^prec * 2^(e+prec)
+    uint64_t prod;
+    if (__builtin_mul_overflow(m, pow5_table[prec], &prod)) {
+        return false;
+    }
+    int shift = e + int(prec);
+    if (shift >= 0) {
+        if (shift >= 64 || (shift > 0 && (prod >> (64 - shift)) != 0)) {
+            return false;
+        }
+        res = prod << shift;
+        return true;
+    }
+    shift = -shift;
+    if (shift >= 64) {
+        return false;
+    }
+    res = prod >> shift;
+    uint64_t rem = prod & ((uint64_t(1) << shift) - 1);
+    uint64_t half = uint64_t(1) << (shift - 1);
+    if (rem > half || (rem == half && (res & 1))) {
+        res++;
+    }
+    return true;
+}
+
+/** Returns whether m*2^e lies exactly halfway between two multiples of 10^-k,
+    i.e. whether m*2^e*10^k*2 is an odd integer.
+*/
+inline bool is_decimal_tie(uint64_t m, int e, int k)
+{
+    if (m == 0) {
+        return false;
+    }
+    unsigned tz = __builtin_ctzll(m);
+    m >>= tz;
+    e += tz;
+
+    // m * 2^(e+k+1) * 5^k with odd m
+    if (e + k + 1 != 0) {
+        return false;
+    }
+    if (k >= 0) {
+        return true;
+    }
+    if (unsigned(-k) >= sizeof(pow5_table)/sizeof(*pow5_table)) {
+        return false;
+    }
+    return m % pow5_table[-k] == 0;
+}
+
+/** Fast path of print_float10_impl for %f, and for %g of values between 1 and
+    10^precision. It applies whenever the digits fit into a 64-bit integer,
+    e.g. for integral values and for values with few decimal places such as
+    prices. No range reduction or per-digit multiplication is needed.
+
+    @a m and @a e describe the value as m * 2^e. Returns false if the fast path
+    is not applicable, in which case nothing is written.
+*/
+template<class Sink>
+CF_FORMAT_INLINE
+bool print_float10_int(Sink& sink, unsigned flags, int width, int prec,
+                       const FmtInfo& fmt, unsigned fltflags, uint64_t m, int e)
+{
+    if (flags & FLAG_FLT_EXP) {
+        return false;
+    }
+
+    uint64_t n;
+    unsigned frac_digits_min;
+    prec = (prec < 0) ? 6 : prec;
+
+    if (flags & FLAG_FLT_NOR) {
+        if (!scale_to_int(m, e, prec, n)) {
+            return false;
+        }
+        frac_digits_min = prec;
+    } else {
+        // 'g': only values whose integral part has between 1 and P digits,
+        // which are printed in normal notation
+        int gprec = (prec == 0) ? 1 : prec;
+        if (gprec >= int(sizeof(pow10_table) / sizeof(*pow10_table))) {
+            return false; // the digits would not fit n
+        }
+        uint64_t int_part;
+        if (e >= 0) {
+            if (e > 10) {
+                return false; // at least 2^63
+            }
+            int_part = m << e;
+        } else {
+            if (e <= -64) {
+                return false;
+            }
+            int_part = m >> -e;
+        }
+        if (int_part == 0) {
+            return false;
+        }
+        // The value is at least 1, so the number of digits of the truncated
+        // integral part determines the exponent
+        int exp10 = count_digits(int_part) - 1;
+        if (exp10 >= gprec) {
+            return false;
+        }
+        prec = gprec - 1 - exp10;
+        if (!scale_to_int(m, e, prec, n)) {
+            return false;
+        }
+        if (n == pow10_table[gprec]) {
+            // Rounding added a digit: 9.99 -> 10.0
+            if (exp10 + 1 >= gprec) {
+                return false;
+            }
+            n /= 10;
+            prec--;
+        }
+        frac_digits_min = (flags & FLAG_ALT) ? prec : 0;
+    }
+
+    // at most 20 integral digits, the dot and 27 fractional digits
+    char buf[64];
+    char* end = buf + sizeof(buf);
+    char* out = format_uint64_r(end, n, prec + 1);
+    char* dotpos = end - prec;
+
+    // Remove trailing zeros and dot if possible
+    char* oi = end;
+    while (oi != dotpos + frac_digits_min && *(oi-1) == '0') {
+        oi--;
+    }
+    end = oi;
+
+    // insert the dot by moving the integral part one position left
+    std::copy(out, dotpos, out - 1);
+    out--;
+    if (end != dotpos || (flags & FLAG_ALT)) {
+        *(dotpos - 1) = fmt.dot;
+    } else {
+        end = dotpos - 1;
+    }
+
+    print_padded(sink, flags, width, fltflags, out, end);
+    return true;
+}
+
+/** Converts the binary exponent of a nonzero significand to a decimal one.
+    On entry the value is signif * 2^exp with the MSB of signif being the
+    integral bit. On return the value is signif * 10^exp10 with the top 4 bits
+    of signif holding the first digit, which is nonzero. err is updated with
+    the error of the computation.
+
+    pos_desc and neg_desc are the tables for positive and negative exponents,
+    see mul2div5_desc and mul5div2_desc. They are parameters so that gentables
+    can benchmark other tables with the same code.
+*/
+template<class U>
+inline void reduce_exp_desc(U& signif, U& err, int exp, int& exp10,
+                            const DivDesc* pos_desc, unsigned pos_count,
+                            const DivDesc* neg_desc, unsigned neg_count)
+{
+    /*  The number is 1.xxx*2^n in binary.
+
+        We need to convert it to base10 encoding. This means multiplying by 2^n,
+        then dividing by such 10^m that the resulting number is within 1..10.
+        Then we can extract the digits by looking at the bits left to the 'dot'
+        position, zeroing them and multiplying the signif by 10.
+
+        Note, that the first process is effectively a conversion of 2^n to
+        appropriate 10^m. We pick such pairs of n,m that 2^n/5^m is as close to
+        1 as possible. This way we can keep the precision of computations near
+        the maximum 64 bits at all times and perform everything without needing
+        multiprecision math.
+    */
+
+    // multiply by 2^exp
+    if (exp >= 0) {
+        const DivDesc* desc = pos_desc;
+
+        for (unsigned i = 0; i < pos_count; ++i, ++desc) {
+
+            unsigned step = desc->exp2 + desc->exp5;
+            while (exp >= step) {
+                signif = muldiv(signif, *desc);
+                err = add(err, muldiv_err(signif));
+                exp10 += desc->exp5;
+                exp -= step;
+                int prev_exp = exp;
+                signif = renormalize_signif(signif, exp);
+                if (exp != prev_exp) {
+                    err = shift_l(err, prev_exp - exp);
+                }
+            }
+        }
+        // make space for a base-10 digit
+        signif = shift_r(signif, 3-exp); // consume the remaining exponent (at most 2)
+        err = shift_r_err(err, 3-exp);
+        while (extract_signif_digit(signif) == 0) {
+            signif = mul(signif, 10);
+            err = mul_err(err);
+            exp10 -= 1;
+        }
+    } else {
+        exp = -exp;
+
+        const DivDesc* desc = neg_desc;
+        for (unsigned i = 0; i < neg_count; ++i, ++desc) {
+
+            unsigned step = desc->exp2 + desc->exp5;
+            while (exp >= step) {
+                signif = muldiv(signif, *desc);
+                err = add(err, muldiv_err(signif));
+                exp10 -= desc->exp5;
+                exp -= step;
+                int prev_exp = exp;
+                signif = renormalize_signif_neg(signif, exp);
+                if (exp != prev_exp) {
+                    err = shift_l(err, exp - prev_exp);
+                }
+            }
+        }
+        // make space for a base-10 digit
+        // consume the remaining exponent (at most 3). This may make the first
+        // digit zero, we must fix this since it would make exp10 incorrect
+        signif = shift_r(signif, 3+exp);
+        err = shift_r_err(err, 3+exp);
+        while (extract_signif_digit(signif) == 0) {
+            signif = mul(signif, 10);
+            err = mul_err(err);
+            exp10 -= 1;
+        }
+    }
+}
+
+template<class U, class T>
+inline void reduce_exp(T, U& signif, U& err, int exp, int& exp10)
+{
+    reduce_exp_desc(signif, err, exp, exp10,
+                    mul2div5_desc, sizeof(mul2div5_desc)/sizeof(*mul2div5_desc),
+                    mul5div2_desc, sizeof(mul5div2_desc)/sizeof(*mul5div2_desc));
+}
+
+/// Same as above for the 16-bit types, see PowDesc
+inline void reduce_exp_table(uint64_t& signif, uint64_t& err, int& exp10,
+                             const PowDesc& desc)
+{
+    signif = mulhi(signif, desc.cf);
+    err = muldiv_err(signif);
+    exp10 = desc.exp10;
+    // the value is now within [0.1, 2), make space for a base-10 digit
+    signif = shift_r(signif, 3);
+    err = shift_r_err(err, 3);
+    while (extract_signif_digit(signif) == 0) {
+        signif = mul(signif, 10);
+        err = mul_err(err);
+        exp10 -= 1;
+    }
+}
+
+inline void reduce_exp(Float16, uint64_t& signif, uint64_t& err, int exp,
+                       int& exp10)
+{
+    reduce_exp_table(signif, err, exp10, float16_pow_desc[exp - float16_min_exp]);
+}
+
+inline void reduce_exp(BFloat16, uint64_t& signif, uint64_t& err, int exp,
+                       int& exp10)
+{
+    reduce_exp_table(signif, err, exp10, bfloat16_pow_desc[exp - bfloat16_min_exp]);
+}
+
+inline uint64_t signif_hi(uint64_t signif) { return signif; }
+inline uint64_t signif_hi(Uint96 signif)   { return signif.hi; }
+
+/** - T is the floating-point type to convert
+    - U is an uint64_t for float and the 16-bit types and Uint96 for double.
+    - max_digits determines the maximum number of significant digits the
+        function should attempt to write. More digits than the width of U
+        can hold can never be certified.
+    - fallback is a printf-style string to use for snprintf if it turns out
+        that the internal precision is insufficient.
+    - Sink is the output sink (see StreamSink and BufferSink)
+*/
+template<class U, class T, class Sink>
+CF_FORMAT_INLINE
+void print_float10_impl(Sink& sink, unsigned flags, int width,
+                        int prec, const FmtInfo& fmt, T val, unsigned max_digits,
+                        const char* fallback)
+{
+    /** The computation keeps a certified bound of its error. All steps
+        truncate: the DivDesc constants, the multiplications in muldiv and the
+        right shifts. Thus the computed significand is never larger than the
+        exact scaled value and err is an upper bound of the difference in ulp
+        of U. Left shifts and multiplications by 10 are exact and scale err
+        along with the significand.
+
+        The rounding direction is taken only when the whole interval
+        [signif, signif + err] lies on one side of the halfway point,
+        otherwise snprintf is used. If the interval contains the halfway
+        point, the value is checked for an exact tie using the original
+        binary significand.
+    */
+
+    CF_PROF_BEGIN(flags);
+
+    U signif;
+    int exp;
+    unsigned fltflags;
+
+    decompose(val, fltflags, signif, exp);
+    CF_PROF_STAGE(PROF_DECOMPOSE);
+
+    // infinity and nan
+    if (fltflags & (FLOAT_INF | FLOAT_NAN)) {
+        print_float_special(sink, flags, width, fltflags);
+        return;
+    }
+    CF_PROF_EXP(exp);
+
+    // The top 53 bits of the significand hold the value as an integer, the
+    // value is exactly int_signif * 2^int_exp
+    uint64_t int_signif = signif_hi(signif) >> 11;
+    int int_exp = exp - 52;
+
+#if !CF_NO_INT_FASTPATH
+    if (print_float10_int(sink, flags, width, prec, fmt, fltflags,
+                          int_signif, int_exp)) {
+        CF_PROF_STAGE(PROF_INT);
+        return;
+    }
+#endif
+
+    int exp10 = 0;
+    U err = make_signif_digit(signif, 0);
+
+    // the significand now contains single 'non-fractional' bit at MSB
+    if (fltflags & FLOAT_ZERO) {
+        // all digits are zero, the exponent is zero too
+    } else {
+        reduce_exp(val, signif, err, exp, exp10);
+    }
+
+    /*  Calculate the estimate the space needed and various other bits.
+
+        Here we can have three main formats:
+
+        'f','F': [-]ddd.ddd
+
+        Precision specifies the minimum number of digits to appear after the
+        decimal point character. The default precision is 6. In the alternative
+        implementation decimal point character is written even if no digits
+        follow it.
+
+        'e','E': [-]d.ddde±dd
+
+        The exponent contains at least two digits, more digits are used only if
+        necessary. If the value is ​0​, the exponent is also ​0​. Precision
+        specifies the minimum number of digits to appear after the decimal
+        point character. The default precision is 6. In the alternative
+        implementation decimal point character is written even if no digits
+        follow it.
+
+        'g','G': Equivalent to either 'e/E' or 'f/F'
+
+        Let P equal the precision if nonzero, 6 if the precision is not
+        specified, or 1 if the precision is ​0​. Then, if a conversion with
+        style E would have an exponent of X:
+
+         * if P > X ≥ −4, the conversion is with style f or F and precision
+            P − 1 − X.
+         * otherwise, the conversion is with style e or E and precision P − 1.
+
+        Unless alternative representation is requested the trailing zeros are
+        removed, also the decimal point character is removed if no fractional
+        part is left. For infinity and not-a-number conversion style see notes.
+    */
+    CF_PROF_STAGE(PROF_REDUCE);
+
+    unsigned int_digits_max, frac_digits_min, frac_digits_max;
+
+    int gprec;
+
+    unsigned buf_size;
+
+    // Check whether we can produce the requested number of significant digits
+    int req_digits;
+    if (flags & FLAG_FLT_NOR) {
+        req_digits = exp10 + 1 + ((prec < 0) ? 6 : prec);
+    } else if (flags & FLAG_FLT_EXP) {
+        req_digits = ((prec < 0) ? 6 : prec) + 1;
+    } else {
+        req_digits = prec;
+    }
+    if (req_digits > int(max_digits)) {
+        print_sprintf(sink, val, fallback);
+        CF_PROF_STAGE(PROF_FALLBACK);
+        return;
+    }
+
+    if (flags & FLAG_FLT_NOR) {
+        // normal notation [-]ddd.ddd
+        prec = (prec < 0) ? 6 : prec;
+        int_digits_max = (exp10 >= 0) ? exp10 + 1 : 1;
+        frac_digits_min = prec;
+        frac_digits_max = prec;
+        buf_size = int_digits_max + 1 + frac_digits_max;
+
+    } else if (flags & FLAG_FLT_EXP) {
+        // exponential notation [-]d.ddde±dd
+        prec = (prec < 0) ? 6 : prec;
+        int_digits_max = 1;
+        frac_digits_min = prec;
+        frac_digits_max = prec;
+        buf_size = int_digits_max + 1 + frac_digits_max + 6; // e[+-]\d\d\d\d
+
+    } else {
+        // 'g': either of the above with custom rules
+        flags |= FLAG_FLT_G;
+        prec = (prec < 0)  ? 6 : prec;
+        prec = (prec == 0) ? 1 : prec;
+        gprec = prec;
+        if ((prec > exp10) && (exp10 >= -4)) {
+            // normal notation
+            flags |= FLAG_FLT_NOR;
+            prec = prec - 1 - exp10;
+            int_digits_max = (exp10 >= 0) ? exp10 + 1 : 1;
+        } else {
+            // exponential notation
+            flags |= FLAG_FLT_EXP;
+            prec = prec - 1;
+            int_digits_max = 1;
+        }
+        frac_digits_max = prec;
+        frac_digits_min = 0; // can erase trailing zeros
+        if (flags & FLAG_ALT) {
+            frac_digits_min = prec;
+        }
+        // Either e[+-]\d\d\d\d or four prepended zeros
+        buf_size = int_digits_max + 1 + frac_digits_max + 6;
+    }
+
+    // Take thousand separators into account when estimating needed characters
+    unsigned sep_count = 0;
+    if (fmt.grouplen > 0) {
+        // Rounding may create additional digit and an additional separator
+        //sep_count = count_thousand_seps(fmt.groups, fmt.grouplen, int_digits_max+1);
+        //buf_size += sep_count;
+    }
+
+    // Reserve space. Two additional characters are needed for the sign and
+    // rounding
+    buf_size += 2 + sep_count;
+    char static_buf[128];
+    std::unique_ptr<char[]> alloced_buf;
+    char* buf;
+    if (buf_size > sizeof(static_buf)) {
+        alloced_buf.reset(new char[buf_size]);
+        buf = alloced_buf.get();
+    } else {
+        buf = static_buf;
+    }
+
+    //char* bufbegin = buf.get() + padspace;
+    char* bufbegin = buf;
+
+    char* outbeg = bufbegin + 2 + sep_count;// Grouping will be added right to left
+                                            // Also add space for sign and rouding
+    char* out = outbeg;
+
+    unsigned lead_zeros = 0;
+    char* first_signif = outbeg;
+
+    // Extract the integral part, add the decimal dot
+    if (exp10 >= 0 || flags & FLAG_FLT_EXP) {
+        for (unsigned i = 0; i < int_digits_max; ++i) {
+            *out++ = extract_update_signif_digit(signif, err) + '0';
+        }
+
+    } else {
+        // The representation has no integral part. The fractional part starts
+        // with -exp10-1 zeros
+        lead_zeros = -exp10 - 1;
+        exp10++;
+        *out++ = '0';
+    }
+
+    // Always add the dot. We can remove it later.
+    char* dotpos = out;
+    *out++ = '.'; // just use a known value, we'll change it to fmt.dot later
+    if (lead_zeros > 0 || *outbeg == '0') {
+        first_signif = out + lead_zeros;
+    }
+
+    // Extract the fractional part
+    unsigned frac_zeros = std::min(lead_zeros, frac_digits_max);
+    out = std::fill_n(out, frac_zeros, '0');
+    for (unsigned i = frac_zeros; i < frac_digits_max; ++i) {
+        *out++ = extract_update_signif_digit(signif, err) + '0';
+    }
+    CF_PROF_STAGE(PROF_EXTRACT);
+
+    // Round using "round to nearest" mode (halfway cases are rounded to even)
+    // TODO: Use current rounding mode
+
+    // signif now holds the remainder below the last printed digit, scaled so
+    // that the top 4 bits are the next digit. The exact remainder lies within
+    // [signif, signif + err].
+    bool round_away_zero = false;
+    if (lead_zeros <= frac_digits_max) {
+        U half = make_signif_digit(signif, 5);
+        bool certain = true;
+        if (!less(err, half)) {
+            // the error exceeds half of the last digit
+            certain = false;
+        } else if (less(half, signif)) {
+            round_away_zero = true;
+        } else if (less(add(signif, err), half)) {
+            // round towards zero
+        } else if (is_zero(err) ||
+                   is_decimal_tie(int_signif, int_exp, int(frac_digits_max) -
+                                  ((flags & FLAG_FLT_EXP) ? exp10 : 0))) {
+            // exact tie, round to even
+            char last = (*(out-1) == '.') ? *(out-2) : *(out-1);
+            round_away_zero = (last - '0') % 2 == 1;
+        } else {
+            // the interval contains the halfway point
+            certain = false;
+        }
+        if (!certain) {
+            CF_PROF_STAGE(PROF_ROUND);
+            print_sprintf(sink, val, fallback);
+            CF_PROF_STAGE(PROF_FALLBACK);
+            return;
+        }
+    }
+
+    if (round_away_zero) {
+        char* oi = out-1;
+
+        // Fractional part
+        bool rounded = false;
+        // Whether the carry reached a zero before the first significant digit
+        bool carried = false;
+        if (*oi != '.') {
+
+            while (*oi == '9') {
+                *oi-- = '0';
+            }
+            if (*oi != '.') {
+                *oi += 1;
+                rounded = true;
+                carried = oi < first_signif;
+            }
+        }
+
+        // Integer part
+        if (!rounded) {
+            // *oi == '.'
+            oi--;
+            while (oi >= outbeg && *oi == '9') {
+                *oi-- = '0';
+            }
+            // Either we found a non-9 digit or we are at the beginning
+            if (oi >= outbeg) {
+                *oi += 1;
+                carried = oi < first_signif;
+            } else {
+                // The number was 9.9999... *10^m
+                // We need to add an additional digit, i.e. exp10 has changed.
+                // No additional digits become 'visible' thus rounding does not
+                // need to be repeated
+                *oi = '1';
+                outbeg--;
+                exp10++;
+
+                if ((flags & FLAG_FLT_G) && (flags & FLAG_FLT_NOR) &&
+                        gprec == exp10) {
+                    // As exp10 has changed, we may need to switch the format.
+                    // That's easy as the number is 10^n.
+                    flags &= ~FLAG_FLT_NOR;
+                    flags |= FLAG_FLT_EXP;
+                    prec = gprec - 1;
+
+                    // Reprint the number
+                    outbeg = out = bufbegin;
+                    *out++ = '1';
+                    dotpos = out;
+                    *out++ = '.';
+                    out = std::fill_n(out, prec, '0');
+
+                    frac_digits_max = prec;
+                    frac_digits_min = (flags & FLAG_ALT) ? prec : 0;
+
+                } else if ((flags & FLAG_FLT_G) && (flags & FLAG_FLT_EXP) &&
+                           exp10 == -4) {
+                    flags &= ~FLAG_FLT_EXP;
+                    flags |= FLAG_FLT_NOR;
+                    prec = prec - exp10; // or gprec - 1 - exp10
+
+                    // Reprint the number
+                    outbeg = out = bufbegin;
+                    out = std::copy("0.0001", "0.0001" + 6, out);
+                    dotpos = bufbegin + 1;
+                    out = std::fill_n(out, prec - 4, '0');
+
+                    frac_digits_max = prec;
+                    frac_digits_min = (flags & FLAG_ALT) ? prec : 0;
+
+                } else if (flags & FLAG_FLT_NOR) {
+                    carried = true;
+                    // nothing to do, precision did not change
+                } else if (flags & FLAG_FLT_EXP) {
+                    // reposition the dot
+                    *dotpos = *(dotpos-1);
+                    *--dotpos = '.';
+                    out--;
+                }
+            }
+        }
+
+        if (carried && (flags & FLAG_FLT_G) && (flags & FLAG_FLT_NOR)) {
+            // One more digit became significant, thus one fractional digit
+            // less is significant
+            out--;
+            prec--;
+            frac_digits_max = prec;
+            frac_digits_min = (flags & FLAG_ALT) ? prec : 0;
+        }
+    }
+
+    CF_PROF_STAGE(PROF_ROUND);
+
+    // Remove trailing zeros and dot if possible
+    char* oi = out-1;
+    while ((oi != dotpos + frac_digits_min) && (*oi == '0')) {
+        oi--;
+    }
+
+    if (oi == dotpos && !(flags & FLAG_ALT)) {
+        oi--;
+    } else {
+        // Using fixed value for dot no longer beneficial
+        *dotpos = fmt.dot;
+    }
+    out = oi+1;
+
+    // Add thousand separators
+    if (fmt.grouplen > 0) {
+        //outbeg = add_thousand_seps(outbeg, fmt.sep, fmt.groups, fmt.grouplen,
+        //                            outbeg, dotpos);
+    }
+
+    // Add exponent
+    if (flags & FLAG_FLT_EXP) {
+        *out++ = (flags & FLAG_UPPERCASE) ? 'E' : 'e';
+        *out++ = (exp10 < 0) ? '-' : '+';
+        exp10 = std::abs(exp10);
+
+        if (exp10 < 10) {
+            *out++ = '0';
+            *out++ = '0' + exp10;
+        } else if (exp10 < 100) {
+            *out++ = '0' + exp10 / 10;
+            *out++ = '0' + exp10 % 10;
+        } else {
+            *out++ = '0' + exp10 / 10 / 10;
+            *out++ = '0' + exp10 / 10 % 10;
+            *out++ = '0' + exp10 % 10;
+        }
+    }
+
+    CF_PROF_STAGE(PROF_TRIM);
+
+    // Write to buffer along to any padding
+    print_padded(sink, flags, width, fltflags, outbeg, out);
+    CF_PROF_STAGE(PROF_WRITE);
+}
+
+/*  Exact conversion of floats
+
+    A float is m * 2^e with m < 2^24 and -149 <= e <= 104. Its decimal
+    expansion is finite and short enough to be generated exactly: the integral
+    part has at most 128 bits and the fractional part at most 149 bits, which
+    fit into a few 32-bit limbs. Thus, unlike print_float10_impl, no error bound
+    is needed, every precision is printed correctly and snprintf is never used.
+*/
+
+/// Generates the decimal digits of a nonzero float, most significant first
+struct FloatDigits {
+    char int_buf[48];       // digits of the integral part at the end
+    const char* int_pos;    // the next digit of the integral part
+    const char* int_end;
+    uint32_t frac[5];       // the fractional part, frac[4] holds the top bits
+    unsigned frac_lo;       // frac[i] is zero for all i < frac_lo
+    char chunk[9];          // the current group of fractional digits
+    unsigned chunk_pos;     // the next digit in chunk, 9 if empty
+    int exp10;              // the decimal exponent of the first digit
+
+    void init(uint32_t m, int e);
+    void next_chunk();
+    unsigned next();
+    bool rest_is_zero() const;
+};
+
+/// Multiplies the fractional part by 10^9, the integral part is the next chunk
+inline void FloatDigits::next_chunk()
+{
+    uint64_t carry = 0;
+    for (unsigned i = frac_lo; i < 5; ++i) {
+        uint64_t t = uint64_t(frac[i]) * 1000000000 + carry;
+        frac[i] = uint32_t(t);
+        carry = t >> 32;
+    }
+    while (frac_lo < 5 && frac[frac_lo] == 0) {
+        frac_lo++;
+    }
+    format_uint64_r(chunk + 9, carry, 9);
+    chunk_pos = 0;
+}
+
+inline void FloatDigits::init(uint32_t m, int e)
+{
+    int_pos = int_end = int_buf + sizeof(int_buf);
+    std::fill_n(frac, 5, 0);
+    frac_lo = 5;
+    chunk_pos = 9;
+
+    if (e >= 0) {
+        // integral value of at most 128 bits, convert it 9 digits at a time
+        uint32_t q[4] = { 0, 0, 0, 0 };
+        uint64_t v = uint64_t(m) << (e % 32);
+        q[e / 32] = uint32_t(v);
+        if (e / 32 < 3) {
+            q[e / 32 + 1] = uint32_t(v >> 32);
+        }
+        unsigned hi = 4;
+        while (q[hi - 1] == 0) {
+            hi--;
+        }
+        while (hi > 0) {
+            uint64_t rem = 0;
+            for (unsigned i = hi; i-- > 0;) {
+                uint64_t cur = (rem << 32) | q[i];
+                q[i] = uint32_t(cur / 1000000000);
+                rem = cur % 1000000000;
+            }
+            while (hi > 0 && q[hi - 1] == 0) {
+                hi--;
+            }
+            int_pos = format_uint64_r((char*) int_pos, rem, (hi > 0) ? 9 : 1);
+        }
+    } else {
+        unsigned s = -e;
+        uint32_t int_part = (s < 32) ? m >> s : 0;
+        uint32_t f = (s < 32) ? m & ((uint32_t(1) << s) - 1) : m;
+        if (int_part != 0) {
+            int_pos = format_uint64_r((char*) int_pos, int_part, 1);
+        }
+        // place the binary point above the top limb, s <= 149
+        unsigned shift = 160 - s;
+        uint64_t v = uint64_t(f) << (shift % 32);
+        frac[shift / 32] = uint32_t(v);
+        if (shift / 32 < 4) {
+            frac[shift / 32 + 1] = uint32_t(v >> 32);
+        }
+        frac_lo = 0;
+        while (frac_lo < 5 && frac[frac_lo] == 0) {
+            frac_lo++;
+        }
+    }
+
+    if (int_pos != int_end) {
+        exp10 = int_end - int_pos - 1;
+        return;
+    }
+    // skip the leading zeros of the fractional part
+    exp10 = -1;
+    for (;;) {
+        next_chunk();
+        while (chunk_pos < 9 && chunk[chunk_pos] == '0') {
+            chunk_pos++;
+        }
+        if (chunk_pos < 9) {
+            exp10 -= chunk_pos;
+            return;
+        }
+        exp10 -= 9;
+    }
+}
+
+inline unsigned FloatDigits::next()
+{
+    if (int_pos != int_end) {
+        return *int_pos++ - '0';
+    }
+    if (chunk_pos == 9) {
+        if (frac_lo == 5) {
+            return 0;
+        }
+        next_chunk();
+    }
+    return chunk[chunk_pos++] - '0';
+}
+
+inline bool FloatDigits::rest_is_zero() const
+{
+    for (const char* p = int_pos; p != int_end; ++p) {
+        if (*p != '0') {
+            return false;
+        }
+    }
+    for (unsigned i = chunk_pos; i < 9; ++i) {
+        if (chunk[i] != '0') {
+            return false;
+        }
+    }
+    return frac_lo == 5;
+}
+
+/** Computes the first @a count significant digits of m*2^e, rounded to
+    nearest, ties to even, as an integer. Sets @a exp10 to the decimal
+    exponent of the first digit. count must be at most 17, so that the
+    intermediate integer with up to two more digits fits into 64 bits.
+
+    The value is scaled by 10^k exactly so that its integral part holds the
+    digits: m*5^k is computed in up to six 32-bit limbs and shifted for k >= 0,
+    the integral part of m*2^e is divided by 10^-k otherwise. The remainder
+    decides the rounding.
+*/
+inline void float_digits(uint32_t m, int e, int count, uint64_t& res,
+                         int& exp10)
+{
+    // floor(log10(2) * x), the exponent is either this or one more
+    int x = e + 31 - __builtin_clz(m);
+    exp10 = (x * 78913) >> 18;
+
+    for (unsigned attempt = 0; attempt < 2; ++attempt) {
+        int k = count - 1 - exp10;
+        uint32_t n[6] = { 0, 0, 0, 0, 0, 0 };
+        int cmp;    // the remainder compared to one half
+        if (k >= 0) {
+            // m*5^k, 5^13 is the largest power that fits into a limb
+            n[0] = m;
+            unsigned len = 1;
+            for (int k5 = k; k5 > 0; k5 -= 13) {
+                uint64_t mul = pow5_table[std::min(k5, 13)];
+                uint64_t carry = 0;
+                for (unsigned i = 0; i < len; ++i) {
+                    uint64_t t = n[i] * mul + carry;
+                    n[i] = uint32_t(t);
+                    carry = t >> 32;
+                }
+                if (carry != 0) {
+                    n[len++] = uint32_t(carry);
+                }
+            }
+            int shift = e + k;
+            if (shift >= 0) {
+                // exact, less than 10^19
+                res = ((uint64_t(n[1]) << 32) | n[0]) << shift;
+                cmp = -1;
+            } else {
+                // the integral part is below 2^64, i.e. within 3 limbs
+                unsigned s = -shift;
+                unsigned w = s / 32;
+                unsigned b = s % 32;
+                uint64_t lo = (uint64_t(n[w+1]) << 32) | n[w];
+                uint64_t hi = (w + 2 < 6) ? n[w+2] : 0;
+                res = (b == 0) ? lo : (lo >> b) | (hi << (64 - b));
+                // the bits below the integral part
+                bool half = (s > 0) && ((n[(s-1) / 32] >> ((s-1) % 32)) & 1);
+                bool below = false;
+                for (unsigned i = 0; i < (s-1) / 32; ++i) {
+                    below |= n[i] != 0;
+                }
+                below |= (n[(s-1) / 32] & ((uint32_t(1) << ((s-1) % 32)) - 1)) != 0;
+                cmp = !half ? -1 : (below ? 1 : 0);
+            }
+        } else {
+            // floor(m*2^e / 10^(-k-1)), the last digit is the rounding digit
+            bool sticky = false;
+            if (e >= 0) {
+                uint64_t v = uint64_t(m) << (e % 32);
+                n[e / 32] = uint32_t(v);
+                n[e / 32 + 1] = uint32_t(v >> 32);
+            } else {
+                // the value is at least 10^count, thus e > -24
+                n[0] = m >> -e;
+                sticky = (m & ((uint32_t(1) << -e) - 1)) != 0;
+            }
+            unsigned len = 4;
+            while (len > 2 && n[len-1] == 0) {
+                len--;
+            }
+            int k10 = -k - 1;
+            for (; k10 >= 9; k10 -= 9) {
+                // constant divisor, compiled to a multiplication
+                uint64_t rem = 0;
+                for (unsigned i = len; i-- > 0;) {
+                    uint64_t cur = (rem << 32) | n[i];
+                    n[i] = uint32_t(cur / 1000000000);
+                    rem = cur % 1000000000;
+                }
+                sticky |= rem != 0;
+                while (len > 2 && n[len-1] == 0) {
+                    len--;
+                }
+            }
+            if (k10 > 0) {
+                uint32_t div = pow10_table[k10];
+                uint64_t rem = 0;
+                for (unsigned i = len; i-- > 0;) {
+                    uint64_t cur = (rem << 32) | n[i];
+                    n[i] = uint32_t(cur / div);
+                    rem = cur % div;
+                }
+                sticky |= rem != 0;
+            }
+            uint64_t q = (uint64_t(n[1]) << 32) | n[0];
+            unsigned digit = q % 10;
+            res = q / 10;
+            cmp = (digit != 5) ? int(digit) - 5 : (sticky ? 1 : 0);
+        }
+        if (cmp > 0 || (cmp == 0 && (res & 1))) {
+            res++;
+        }
+        if (res < pow10_table[count]) {
+            return;
+        }
+        if (attempt == 0) {
+            // the exponent is one more, or the value rounded up to 10^count,
+            // either way it is right to round with one digit less
+            exp10++;
+        }
+    }
+    // 9.99 -> 10.0 with the corrected exponent
+    res /= 10;
+    exp10++;
+}
+
+/// Same as print_float10_impl for floats, using FloatDigits
+template<class Sink>
+CF_FORMAT_INLINE
+void print_float10_exact(Sink& sink, unsigned flags, int width, int prec,
+                         const FmtInfo& fmt, float val)
+{
+    CF_PROF_BEGIN(flags);
+
+    uint32_t fi;
+    std::memcpy(&fi, &val, sizeof(val));
+    unsigned fltflags = ((fi >> 31) == 1) ? FLOAT_NEG : FLOAT_NONE;
+    fi &= 0x7fffffff;
+    unsigned bexp = fi >> 23;
+    uint32_t m = fi & 0x007fffff;
+    if (bexp == 0xff) {
+        fltflags |= m ? FLOAT_NAN : FLOAT_INF;
+        print_float_special(sink, flags, width, fltflags);
+        return;
+    }
+    int e = -149;
+    if (bexp != 0) {
+        m |= 0x00800000;
+        e = int(bexp) - 150;
+    }
+    CF_PROF_EXP(e);
+    CF_PROF_STAGE(PROF_DECOMPOSE);
+
+#if !CF_NO_INT_FASTPATH
+    if (print_float10_int(sink, flags, width, prec, fmt, fltflags, m, e)) {
+        CF_PROF_STAGE(PROF_INT);
+        return;
+    }
+#endif
+
+    // The number of significant digits to print. Zero or less for %f of
+    // values below the last printed digit.
+    prec = (prec < 0) ? 6 : prec;
+    int gprec = (prec == 0) ? 1 : prec;
+    int count = (flags & FLAG_FLT_EXP) ? prec + 1 : gprec;
+
+    char static_digits[64];
+    std::unique_ptr<char[]> alloced_digits;
+    char* digits = static_digits;
+
+    // digits[0, n) hold the significant digits, further digits are zero
+    int n = 0;
+    int exp10 = 0;
+    uint64_t int_digits;
+    if (m == 0) {
+        // all digits are zero, the exponent is zero too
+    } else if (!(flags & FLAG_FLT_NOR) && count <= 17) {
+        float_digits(m, e, count, int_digits, exp10);
+        format_uint64_r(digits + count, int_digits, count);
+        n = count;
+        CF_PROF_STAGE(PROF_EXTRACT);
+    } else {
+        FloatDigits gen;
+        gen.init(m, e);
+        exp10 = gen.exp10;
+        if (flags & FLAG_FLT_NOR) {
+            count = exp10 + 1 + prec;
+        }
+        if (count >= int(sizeof(static_digits))) {
+            alloced_digits.reset(new char[count + 1]);
+            digits = alloced_digits.get();
+        }
+        unsigned next = 0;
+        bool rest_zero = true;
+        if (count >= 0) {
+            for (; n < count; ++n) {
+                digits[n] = '0' + gen.next();
+            }
+            next = gen.next();
+            rest_zero = gen.rest_is_zero();
+        }
+        CF_PROF_STAGE(PROF_EXTRACT);
+
+        // Round to nearest, ties to even. The digits before the first one are
+        // zero, thus even.
+        bool odd = n > 0 && (digits[n-1] - '0') % 2 == 1;
+        if (next > 5 || (next == 5 && (!rest_zero || odd))) {
+            int i = n - 1;
+            while (i >= 0 && digits[i] == '9') {
+                digits[i--] = '0';
+            }
+            if (i >= 0) {
+                digits[i]++;
+            } else {
+                // 9.99 -> 10.0, the first digit moves one position up
+                digits[0] = '1';
+                n = std::max(n, 1);
+                exp10++;
+            }
+        }
+        CF_PROF_STAGE(PROF_ROUND);
+    }
+
+    bool exp_style = flags & FLAG_FLT_EXP;
+    unsigned frac_digits_min = prec;
+    if (!(flags & (FLAG_FLT_NOR | FLAG_FLT_EXP))) {
+        // 'g', the exponent is known after rounding
+        if (gprec > exp10 && exp10 >= -4) {
+            prec = gprec - 1 - exp10;
+        } else {
+            exp_style = true;
+            prec = gprec - 1;
+        }
+        frac_digits_min = (flags & FLAG_ALT) ? prec : 0;
+    }
+
+    // integral digits, dot, fractional digits and e[+-]dd
+    int int_digits_max = exp_style ? 1 : std::max(exp10, 0) + 1;
+    unsigned buf_size = int_digits_max + 1 + prec + 4;
+    char static_buf[128];
+    std::unique_ptr<char[]> alloced_buf;
+    char* buf = static_buf;
+    if (buf_size > sizeof(static_buf)) {
+        alloced_buf.reset(new char[buf_size]);
+        buf = alloced_buf.get();
+    }
+
+    // The output consists of the digits from position first_pos on, with
+    // zeros before and after them
+    char* out = buf;
+    int first_pos = exp_style ? 0 : int_digits_max - 1 - exp10;
+    int total = int_digits_max + prec;
+    int lead = std::min(first_pos, total);
+    int len = std::min(n, total - lead);
+    out = std::fill_n(out, lead, '0');
+    out = std::copy(digits, digits + len, out);
+    out = std::fill_n(out, total - lead - len, '0');
+
+    // insert the dot by moving the fractional part one position right
+    char* dotpos = buf + int_digits_max;
+    std::copy_backward(dotpos, out, out + 1);
+    *dotpos = fmt.dot;
+    out++;
+
+    // Remove trailing zeros and dot if possible
+    while (out > dotpos + 1 + frac_digits_min && *(out-1) == '0') {
+        out--;
+    }
+    if (out == dotpos + 1 && !(flags & FLAG_ALT)) {
+        out--;
+    }
+
+    if (exp_style) {
+        *out++ = (flags & FLAG_UPPERCASE) ? 'E' : 'e';
+        *out++ = (exp10 < 0) ? '-' : '+';
+        // at most 45 for floats
+        unsigned abs_exp10 = std::abs(exp10);
+        *out++ = '0' + abs_exp10 / 10;
+        *out++ = '0' + abs_exp10 % 10;
+    }
+    CF_PROF_STAGE(PROF_TRIM);
+
+    print_padded(sink, flags, width, fltflags, buf, out);
+    CF_PROF_STAGE(PROF_WRITE);
+}
+
+/*  Hexadecimal output: [-]0xh.hhhp±d
+
+    The significand is printed directly, thus no range reduction is needed.
+    The leading digit is 1 for normal numbers and 0 for zero and denormal
+    numbers. Denormals use the minimum exponent of the type. If precision is
+    not given, as many digits as needed to represent the value exactly are
+    printed. Otherwise the significand is rounded to nearest, ties to even.
+*/
+
+/** Decomposes a floating-point number for hexadecimal output. @a signif is
+    set to the significand including the leading digit. The fractional part
+    occupies the low @a frac_digits * 4 bits of it.
+*/
+inline void decompose_hex(double f, unsigned& fltflags, uint64_t& signif,
+                          unsigned& frac_digits, int& exp)
+{
+    uint64_t fi;
+    std::memcpy(&fi, &f, sizeof(f));
+    fltflags = ((fi >> 63) == 1) ? FLOAT_NEG : FLOAT_NONE;
+    fi &= 0x7fffffffffffffff;
+    exp = fi >> 52;
+    signif = fi & 0x000fffffffffffff;
+    frac_digits = 13;
+    if (exp == 0x7ff) {
+        fltflags |= signif ? FLOAT_NAN : FLOAT_INF;
+        return;
+    }
+    if (exp == 0) {
+        exp = signif ? -1022 : 0;
+        return;
+    }
+    signif |= 0x0010000000000000;
+    exp -= 1023;
+}
+
+/// Same as above, except that the float is not converted to double first
+inline void decompose_hex(float f, unsigned& fltflags, uint64_t& signif,
+                          unsigned& frac_digits, int& exp)
+{
+    uint32_t fi;
+    std::memcpy(&fi, &f, sizeof(f));
+    fltflags = ((fi >> 31) == 1) ? FLOAT_NEG : FLOAT_NONE;
+    fi &= 0x7fffffff;
+    exp = fi >> 23;
+    signif = (fi & 0x007fffff) << 1; // 23 bits, pad to a whole hex digit
+    frac_digits = 6;
+    if (exp == 0xff) {
+        fltflags |= signif ? FLOAT_NAN : FLOAT_INF;
+        return;
+    }
+    if (exp == 0) {
+        exp = signif ? -126 : 0;
+        return;
+    }
+    signif |= 0x01000000;
+    exp -= 127;
+}
+
+/** Prints a number decomposed by decompose_hex. The 0x prefix is omitted if
+    @a prefix is false.
+*/
+template<class Sink>
+void print_float_hex_impl(Sink& sink, unsigned flags, int width, int prec,
+                          unsigned fltflags, uint64_t signif,
+                          unsigned frac_digits, int exp, bool prefix)
+{
+    if (fltflags & (FLOAT_INF | FLOAT_NAN)) {
+        print_float_special(sink, flags, width, fltflags);
+        return;
+    }
+
+    if (prec < 0) {
+        // Drop the trailing zero digits
+        if ((signif & ((uint64_t(1) << frac_digits*4) - 1)) == 0) {
+            signif >>= frac_digits*4;
+            frac_digits = 0;
+        } else {
+            while ((signif & 0xf) == 0) {
+                signif >>= 4;
+                frac_digits--;
+            }
+        }
+        prec = frac_digits;
+
+    } else if (unsigned(prec) < frac_digits) {
+        // Round to nearest, ties to even. The carry may propagate to the
+        // leading digit, which then becomes 2 (or 1 for denormals).
+        unsigned drop = (frac_digits - prec) * 4;
+        uint64_t rem = signif & ((uint64_t(1) << drop) - 1);
+        uint64_t half = uint64_t(1) << (drop - 1);
+        signif >>= drop;
+        if (rem > half || (rem == half && (signif & 1))) {
+            signif++;
+        }
+        frac_digits = prec;
+    }
+
+    const char* digits = (flags & FLAG_UPPERCASE) ? "0123456789ABCDEF"
+                                                  : "0123456789abcdef";
+
+    // 0x, the leading digit, dot, digits, p, sign and at most 5 exponent
+    // digits
+    char static_buf[64];
+    std::unique_ptr<char[]> alloced_buf;
+    char* buf = static_buf;
+    if (unsigned(prec) + 12 > sizeof(static_buf)) {
+        alloced_buf.reset(new char[prec + 12]);
+        buf = alloced_buf.get();
+    }
+
+    char* out = buf;
+    unsigned prefix_len = 0;
+    if (prefix) {
+        *out++ = '0';
+        *out++ = (flags & FLAG_UPPERCASE) ? 'X' : 'x';
+        prefix_len = 2;
+    }
+    *out++ = digits[signif >> frac_digits*4];
+    if (prec > 0 || (flags & FLAG_ALT)) {
+        *out++ = '.';
+    }
+    for (int i = frac_digits - 1; i >= 0; --i) {
+        *out++ = digits[(signif >> i*4) & 0xf];
+    }
+    out = std::fill_n(out, prec - frac_digits, '0');
+
+    *out++ = (flags & FLAG_UPPERCASE) ? 'P' : 'p';
+    *out++ = (exp < 0) ? '-' : '+';
+    out = std::to_chars(out, out + 5, std::abs(exp)).ptr;
+
+    print_padded(sink, flags, width, fltflags, buf, out, prefix_len);
+}
+
+/// Hexadecimal output as printf produces it, i.e. floats are converted to double
+template<class Sink>
+void print_float_hex(Sink& sink, unsigned flags, int width, int prec, double val)
+{
+    unsigned fltflags;
+    uint64_t signif;
+    unsigned frac_digits;
+    int exp;
+    decompose_hex(val, fltflags, signif, frac_digits, exp);
+    print_float_hex_impl(sink, flags, width, prec, fltflags, signif,
+                         frac_digits, exp, true);
+}
+
+template<class Sink>
+void print_float_hex(Sink& sink, unsigned flags, int width, int prec, Float16 val)
+{
+    print_float_hex(sink, flags, width, prec, half_to_float(val));
+}
+
+template<class Sink>
+void print_float_hex(Sink& sink, unsigned flags, int width, int prec, BFloat16 val)
+{
+    print_float_hex(sink, flags, width, prec, half_to_float(val));
+}
+
+/// Type-specific parameters of print_float10_impl. See the description there.
+template<class T> struct FloatTraits;
+
+// max_digits is the leading digit plus the whole decimal digits that fit in
+// the remaining bits of Signif
+template<> struct FloatTraits<float> {
+    typedef uint64_t Signif;
+    static const unsigned max_digits = 19;
+    // the number of significant digits that always round-trips
+    static const unsigned roundtrip_digits = 9;
+};
+
+template<> struct FloatTraits<double> {
+    typedef Uint96 Signif;
+    static const unsigned max_digits = 28;
+    static const unsigned roundtrip_digits = 17;
+};
+
+template<> struct FloatTraits<Float16> {
+    typedef uint64_t Signif;
+    static const unsigned max_digits = 19;
+    static const unsigned roundtrip_digits = 5;
+};
+
+template<> struct FloatTraits<BFloat16> {
+    typedef uint64_t Signif;
+    static const unsigned max_digits = 19;
+    static const unsigned roundtrip_digits = 4;
+};
+
+template<class T, class Sink>
+CF_FORMAT_INLINE
+void print_float10_dec(Sink& sink, unsigned flags, int width, int prec,
+                       const FmtInfo& fmt, T val, const char* fallback)
+{
+    typedef FloatTraits<T> Tr;
+    print_float10_impl<typename Tr::Signif>(sink, flags, width, prec, fmt, val,
+                                            Tr::max_digits, fallback);
+}
+
+// Define CF_NO_FLOAT_EXACT to format floats with print_float10_impl
+#if !CF_NO_FLOAT_EXACT
+template<class Sink>
+CF_FORMAT_INLINE
+void print_float10_dec(Sink& sink, unsigned flags, int width, int prec,
+                       const FmtInfo& fmt, float val, const char*)
+{
+    print_float10_exact(sink, flags, width, prec, fmt, val);
+}
+#endif
+
+template<class T, class Sink>
+CF_FORMAT_INLINE
+void print_float10_sink(Sink& sink, unsigned flags, int width, int prec,
+                        const FmtInfo& fmt, T val, const char* fallback)
+{
+    if (flags & FLAG_FLT_HEX) {
+        print_float_hex(sink, flags, width, prec, val);
+        return;
+    }
+    print_float10_dec(sink, flags, width, prec, fmt, val, fallback);
+}
+
+template<class T>
+CF_FORMAT_INLINE
+char* print_float10_buf(char* first, char* last, unsigned flags,
+                        int width, int prec, const FmtInfo& fmt, T val,
+                        const char* fallback)
+{
+    BufferSink sink(first, last);
+    print_float10_sink(sink, flags, width, prec, fmt, val, fallback);
+    return sink.overflow ? NULL : sink.out;
+}
+
+} // namespace cformat_detail
+
+#endif
@@ -0,0 +1,109 @@
+/*
+    Copyright (C) 2014  Povilas Kanapickas <povilas@radix.lt>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CFORMAT_INLINE_H
+#define CFORMAT_INLINE_H
+
+#ifndef CF_FORMAT_INLINE
+#define CF_FORMAT_INLINE inline __attribute__((always_inline))
+#endif
+
+#include "cformat.h"
+#include "cformat_impl.h"
+
+/** Header-only versions of print_float10. The output is the same as that of
+    the out-of-line functions declared in cformat.h, which remain available.
+
+    The whole formatter is compiled into the calling translation unit, so
+    arguments that are constant at the call site, e.g. the flags and the
+    precision, are propagated into it and the branches on them are folded.
+    This costs code size in every caller; use it for the few hot call sites.
+    The inlining is forced, see CF_FORMAT_INLINE in cformat_impl.h.
+*/
+CF_FORMAT_INLINE
+void print_float10_inline(std::ostream& ostr, unsigned flags, int width,
+                          int prec, const FmtInfo& fmt, float val,
+                          const char* fallback)
+{
+    cformat_detail::StreamSink sink(ostr);
+    cformat_detail::print_float10_sink(sink, flags, width, prec, fmt, val, fallback);
+}
+
+CF_FORMAT_INLINE
+void print_float10_inline(std::ostream& ostr, unsigned flags, int width,
+                          int prec, const FmtInfo& fmt, double val,
+                          const char* fallback)
+{
+    cformat_detail::StreamSink sink(ostr);
+    cformat_detail::print_float10_sink(sink, flags, width, prec, fmt, val, fallback);
+}
+
+CF_FORMAT_INLINE
+void print_float10_inline(std::ostream& ostr, unsigned flags, int width,
+                          int prec, const FmtInfo& fmt, Float16 val,
+                          const char* fallback)
+{
+    cformat_detail::StreamSink sink(ostr);
+    cformat_detail::print_float10_sink(sink, flags, width, prec, fmt, val, fallback);
+}
+
+CF_FORMAT_INLINE
+void print_float10_inline(std::ostream& ostr, unsigned flags, int width,
+                          int prec, const FmtInfo& fmt, BFloat16 val,
+                          const char* fallback)
+{
+    cformat_detail::StreamSink sink(ostr);
+    cformat_detail::print_float10_sink(sink, flags, width, prec, fmt, val, fallback);
+}
+
+CF_FORMAT_INLINE
+char* print_float10_inline(char* first, char* last, unsigned flags,
+                           int width, int prec, const FmtInfo& fmt,
+                           float val, const char* fallback)
+{
+    return cformat_detail::print_float10_buf(first, last, flags, width, prec,
+                                             fmt, val, fallback);
+}
+
+CF_FORMAT_INLINE
+char* print_float10_inline(char* first, char* last, unsigned flags,
+                           int width, int prec, const FmtInfo& fmt,
+                           double val, const char* fallback)
+{
+    return cformat_detail::print_float10_buf(first, last, flags, width, prec,
+                                             fmt, val, fallback);
+}
+
+CF_FORMAT_INLINE
+char* print_float10_inline(char* first, char* last, unsigned flags,
+                           int width, int prec, const FmtInfo& fmt,
+                           Float16 val, const char* fallback)
+{
+    return cformat_detail::print_float10_buf(first, last, flags, width, prec,
+                                             fmt, val, fallback);
+}
+
+CF_FORMAT_INLINE
+char* print_float10_inline(char* first, char* last, unsigned flags,
+                           int width, int prec, const FmtInfo& fmt,
+                           BFloat16 val, const char* fallback)
+{
+    return cformat_detail::print_float10_buf(first, last, flags, width, prec,
+                                             fmt, val, fallback);
+}
+
+#endif
@@ -0,0 +1,134 @@
+/*
+    Copyright (C) 2014  Povilas Kanapickas <povilas@radix.lt>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "cformat.h"
+#include "cformat_prof.h"
+
+#if CF_PROFILE
+
+#include <cstring>
+
+ProfData g_prof_data;
+
+static const char* prof_stage_names[PROF_NUM_STAGES] = {
+    "decompose", "int", "reduce", "extract", "round", "trim", "write", "fallback"
+};
+
+static const char* prof_mode_names[PROF_NUM_MODES] = { "f", "e", "g" };
+
+ProfData::ProfData()
+{
+    std::memset(hist, 0, sizeof(hist));
+    std::memset(sum, 0, sizeof(sum));
+    std::memset(samples, 0, sizeof(samples));
+    const char* env = std::getenv("CF_PROF_PERIOD");
+    // parsed as int, so that negative values are rejected as well
+    int env_period = env ? std::atoi(env) : 1;
+    period = env_period < 1 ? 1 : env_period;
+}
+
+/// Returns the upper bound of the log2 bucket containing the q-th quantile
+static uint64_t prof_quantile(const uint64_t* hist, uint64_t total, double q)
+{
+    uint64_t target = uint64_t(total * q);
+    uint64_t acc = 0;
+    for (unsigned h = 0; h < PROF_NUM_HIST; ++h) {
+        acc += hist[h];
+        if (acc > target) {
+            return h ? uint64_t(1) << h : 0;
+        }
+    }
+    return uint64_t(1) << (PROF_NUM_HIST - 1);
+}
+
+ProfData::~ProfData()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    const char* unit = "cycles";
+#else
+    const char* unit = "ns";
+#endif
+    uint64_t total_samples = 0;
+    for (unsigned m = 0; m < PROF_NUM_MODES; ++m) {
+        for (unsigned b = 0; b < PROF_NUM_EXP_BUCKETS; ++b) {
+            total_samples += samples[m][b];
+        }
+    }
+    if (total_samples == 0) {
+        return;
+    }
+
+    std::fprintf(stderr, "cformat profile: %llu samples, 1 in %u calls, unit: %s\n",
+                 (unsigned long long) total_samples, period, unit);
+
+    // Overall per-stage distribution. Quantiles are the upper bounds of the
+    // log2 histogram buckets.
+    std::fprintf(stderr, "\n%-10s %10s %10s %8s %8s %8s %8s\n",
+                 "stage", "count", "mean", "p50", "p90", "p99", "p99.9");
+    for (unsigned s = 0; s < PROF_NUM_STAGES; ++s) {
+        uint64_t h[PROF_NUM_HIST] = {};
+        uint64_t count = 0, total = 0;
+        for (unsigned m = 0; m < PROF_NUM_MODES; ++m) {
+            for (unsigned b = 0; b < PROF_NUM_EXP_BUCKETS; ++b) {
+                for (unsigned i = 0; i < PROF_NUM_HIST; ++i) {
+                    h[i] += hist[m][b][s][i];
+                    count += hist[m][b][s][i];
+                }
+                total += sum[m][b][s];
+            }
+        }
+        if (count == 0) {
+            continue;
+        }
+        std::fprintf(stderr, "%-10s %10llu %10.1f %8llu %8llu %8llu %8llu\n",
+                     prof_stage_names[s], (unsigned long long) count,
+                     double(total) / count,
+                     (unsigned long long) prof_quantile(h, count, 0.5),
+                     (unsigned long long) prof_quantile(h, count, 0.9),
+                     (unsigned long long) prof_quantile(h, count, 0.99),
+                     (unsigned long long) prof_quantile(h, count, 0.999));
+    }
+
+    // Mean time per stage for each format mode and exponent bucket. The mean
+    // is computed over all samples in the row, including those that did not
+    // reach the stage.
+    std::fprintf(stderr, "\n%-4s %-13s %10s", "mode", "exp2", "samples");
+    for (unsigned s = 0; s < PROF_NUM_STAGES; ++s) {
+        std::fprintf(stderr, " %9s", prof_stage_names[s]);
+    }
+    std::fprintf(stderr, "\n");
+    for (unsigned m = 0; m < PROF_NUM_MODES; ++m) {
+        for (unsigned b = 0; b < PROF_NUM_EXP_BUCKETS; ++b) {
+            uint64_t n = samples[m][b];
+            if (n == 0) {
+                continue;
+            }
+            int lo = PROF_EXP_MIN + int(b << PROF_EXP_BUCKET_BITS);
+            int hi = lo + (1 << PROF_EXP_BUCKET_BITS) - 1;
+            char range[32];
+            std::snprintf(range, sizeof(range), "[%d,%d]", lo, hi);
+            std::fprintf(stderr, "%-4s %-13s %10llu", prof_mode_names[m], range,
+                         (unsigned long long) n);
+            for (unsigned s = 0; s < PROF_NUM_STAGES; ++s) {
+                std::fprintf(stderr, " %9.1f", double(sum[m][b][s]) / n);
+            }
+            std::fprintf(stderr, "\n");
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,179 @@
+/*
+    Copyright (C) 2014  Povilas Kanapickas <povilas@radix.lt>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CFORMAT_PROF_H
+#define CFORMAT_PROF_H
+
+/*  Per-stage profiling of print_float10_impl. Enabled by defining CF_PROFILE
+    to 1, otherwise all macros expand to nothing.
+
+    The time between the stage boundaries is measured using rdtsc (cycles) on
+    x86 and clock_gettime (nanoseconds) elsewhere. For each stage a log2
+    histogram of the durations is collected, broken down by format mode and
+    binary exponent bucket. The report is printed to stderr at exit.
+
+    Only every Nth call is sampled, where N is taken from the CF_PROF_PERIOD
+    environment variable (default 1). Calls that are not sampled cost one
+    thread-local counter increment.
+*/
+
+#if CF_PROFILE
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+enum ProfStage {
+    PROF_DECOMPOSE,     // decompose()
+    PROF_INT,           // the whole integer fast path
+    PROF_REDUCE,        // range reduction to a base-10 exponent
+    PROF_EXTRACT,       // digit extraction
+    PROF_ROUND,         // rounding, including the tail scan and carry
+    PROF_TRIM,          // trailing zero removal and exponent
+    PROF_WRITE,         // padding and writes to the sink
+    PROF_FALLBACK,      // snprintf fallback
+    PROF_NUM_STAGES
+};
+
+enum ProfMode {
+    PROF_MODE_F,
+    PROF_MODE_E,
+    PROF_MODE_G,
+    PROF_NUM_MODES
+};
+
+static const unsigned PROF_EXP_BUCKET_BITS = 6;     // 64 binary exponents
+static const int PROF_EXP_MIN = -1152;
+static const unsigned PROF_NUM_EXP_BUCKETS = 2304 >> PROF_EXP_BUCKET_BITS;
+static const unsigned PROF_NUM_HIST = 32;          // log2 buckets
+
+struct ProfData {
+    uint64_t hist[PROF_NUM_MODES][PROF_NUM_EXP_BUCKETS][PROF_NUM_STAGES][PROF_NUM_HIST];
+    uint64_t sum[PROF_NUM_MODES][PROF_NUM_EXP_BUCKETS][PROF_NUM_STAGES];
+    uint64_t samples[PROF_NUM_MODES][PROF_NUM_EXP_BUCKETS];
+    unsigned period;
+
+    ProfData();
+    ~ProfData();
+};
+
+extern ProfData g_prof_data;
+
+inline uint64_t prof_now()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+inline unsigned prof_log2(uint64_t v)
+{
+    return v ? 64 - __builtin_clzll(v) : 0;
+}
+
+/// Records the stage durations of a single print_float10_impl call
+class ProfSample {
+public:
+    ProfSample(unsigned flags)
+    {
+        static __thread unsigned counter = 0;
+        active_ = ++counter >= g_prof_data.period;
+        if (!active_) {
+            return;
+        }
+        counter = 0;
+        mode_ = (flags & FLAG_FLT_NOR) ? PROF_MODE_F :
+                (flags & FLAG_FLT_EXP) ? PROF_MODE_E : PROF_MODE_G;
+        bucket_ = 0;
+        for (unsigned i = 0; i < PROF_NUM_STAGES; ++i) {
+            time_[i] = 0;
+        }
+        last_ = prof_now();
+    }
+
+    /// Exponents outside the range are counted in the first or last bucket
+    void set_exp(int exp)
+    {
+        if (active_) {
+            int rel = exp - PROF_EXP_MIN;
+            int max_rel = int(PROF_NUM_EXP_BUCKETS << PROF_EXP_BUCKET_BITS) - 1;
+            if (rel < 0) {
+                rel = 0;
+            } else if (rel > max_rel) {
+                rel = max_rel;
+            }
+            bucket_ = unsigned(rel) >> PROF_EXP_BUCKET_BITS;
+        }
+    }
+
+    void mark(ProfStage stage)
+    {
+        if (active_) {
+            uint64_t now = prof_now();
+            time_[stage] += now - last_;
+            last_ = now;
+        }
+    }
+
+    ~ProfSample()
+    {
+        if (!active_) {
+            return;
+        }
+        ProfData& d = g_prof_data;
+        __atomic_fetch_add(&d.samples[mode_][bucket_], 1, __ATOMIC_RELAXED);
+        for (unsigned i = 0; i < PROF_NUM_STAGES; ++i) {
+            if (time_[i] == 0) {
+                continue;
+            }
+            // longer durations are counted in the last bucket
+            unsigned h = std::min(prof_log2(time_[i]), PROF_NUM_HIST - 1);
+            __atomic_fetch_add(&d.hist[mode_][bucket_][i][h], 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&d.sum[mode_][bucket_][i], time_[i], __ATOMIC_RELAXED);
+        }
+    }
+
+private:
+    bool active_;
+    unsigned mode_;
+    unsigned bucket_;
+    uint64_t last_;
+    uint64_t time_[PROF_NUM_STAGES];
+};
+
+#define CF_PROF_BEGIN(flags)        ProfSample prof_sample(flags)
+#define CF_PROF_EXP(exp)            prof_sample.set_exp(exp)
+#define CF_PROF_STAGE(stage)        prof_sample.mark(stage)
+
+#else
+
+#define CF_PROF_BEGIN(flags)
+#define CF_PROF_EXP(exp)
+#define CF_PROF_STAGE(stage)
+
+#endif
+
+#endif
@@ -0,0 +1,786 @@
+/*
+    Copyright (C) 2014  Povilas Kanapickas <povilas@radix.lt>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*  Generates cformat_tables.h, the range reduction tables mul2div5_desc and
+    mul5div2_desc used by reduce_exp and the power of ten table
+    shortest_pow10_desc used by the shortest formatting of cf::to_chars.
+
+    usage: gentables [options]
+
+     -o file    write the header to file instead of stdout
+     -c bytes   the maximum size of both tables together (default 2048). Larger
+                tables need fewer multiplications per value, but take more
+                space in the L1 cache of the application
+     -r count   the number of benchmark repetitions (default 64)
+     -e bits    the maximum certified error of the reduction in bits. By
+                default the errors of the tables compiled into the program
+     -v         print all candidates to stderr
+
+    A table entry multiplies the significand by 2^exp2/5^exp5 or 5^exp5/2^exp2
+    and consumes exp2 + exp5, the step, of the binary exponent. Only steps for
+    which the multiplier is in [0.5, 1) are usable, so that the significand
+    loses at most one bit. reduce_exp walks a table from the largest step down
+    and applies each entry as long as the step fits, thus for a given number
+    of entries the set of steps determines the average number of
+    multiplications.
+
+    For each table size the program searches the set of steps that minimizes
+    the average number of multiplications over all binary exponents of double.
+    The constants are computed exactly with big integer arithmetic and each is
+    checked to be the truncation of the exact quotient, both as 96 bits and as
+    the upper 64 bits alone. The reduction of every binary exponent of double
+    and float is then checked against the exact value for several significands,
+    which also yields the worst certified error of the candidate. The tables
+    are emitted in the 96-bit layout of DivDesc.
+
+    Finally the candidates are benchmarked with reduce_exp_desc, i.e. the
+    code of the formatter, on double and float significands with random
+    exponents. The candidate with the lowest sum of both times whose error does
+    not exceed the limit is written out.
+
+    shortest_pow10_desc does not depend on the machine. Its entries are the
+    128-bit constants of the Schubfach algorithm, computed by long division
+    and checked the same way as the range reduction constants.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "cformat.h"
+#include "cformat_impl.h"
+
+using namespace cformat_detail;
+
+/// Arbitrary precision unsigned integer, least significant limb first
+struct BigUint {
+    std::vector<uint32_t> limbs;
+
+    BigUint(uint64_t v = 0)
+    {
+        while (v != 0) {
+            limbs.push_back(uint32_t(v));
+            v >>= 32;
+        }
+    }
+
+    void trim()
+    {
+        while (!limbs.empty() && limbs.back() == 0) {
+            limbs.pop_back();
+        }
+    }
+
+    BigUint& add_small(uint32_t a)
+    {
+        uint64_t carry = a;
+        for (unsigned i = 0; i < limbs.size() && carry != 0; ++i) {
+            carry += limbs[i];
+            limbs[i] = uint32_t(carry);
+            carry >>= 32;
+        }
+        if (carry != 0) {
+            limbs.push_back(uint32_t(carry));
+        }
+        return *this;
+    }
+
+    BigUint& mul_small(uint32_t m)
+    {
+        uint64_t carry = 0;
+        for (unsigned i = 0; i < limbs.size(); ++i) {
+            carry += uint64_t(limbs[i]) * m;
+            limbs[i] = uint32_t(carry);
+            carry >>= 32;
+        }
+        if (carry != 0) {
+            limbs.push_back(uint32_t(carry));
+        }
+        trim();
+        return *this;
+    }
+
+    BigUint& shl(unsigned n)
+    {
+        if (limbs.empty()) {
+            return *this;
+        }
+        limbs.insert(limbs.begin(), n / 32, 0);
+        n %= 32;
+        if (n != 0) {
+            uint32_t carry = 0;
+            for (unsigned i = 0; i < limbs.size(); ++i) {
+                uint32_t next = limbs[i] >> (32 - n);
+                limbs[i] = (limbs[i] << n) | carry;
+                carry = next;
+            }
+            if (carry != 0) {
+                limbs.push_back(carry);
+            }
+        }
+        return *this;
+    }
+
+    /// Subtracts b, which must not be larger
+    BigUint& sub(const BigUint& b)
+    {
+        int64_t borrow = 0;
+        for (unsigned i = 0; i < limbs.size(); ++i) {
+            int64_t d = int64_t(limbs[i]) - borrow;
+            if (i < b.limbs.size()) {
+                d -= b.limbs[i];
+            }
+            borrow = d < 0 ? 1 : 0;
+            limbs[i] = uint32_t(d + (borrow << 32));
+        }
+        trim();
+        return *this;
+    }
+};
+
+int compare(const BigUint& a, const BigUint& b)
+{
+    if (a.limbs.size() != b.limbs.size()) {
+        return a.limbs.size() < b.limbs.size() ? -1 : 1;
+    }
+    for (unsigned i = a.limbs.size(); i-- > 0;) {
+        if (a.limbs[i] != b.limbs[i]) {
+            return a.limbs[i] < b.limbs[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+BigUint mul(const BigUint& a, const BigUint& b)
+{
+    BigUint r;
+    r.limbs.assign(a.limbs.size() + b.limbs.size(), 0);
+    for (unsigned i = 0; i < a.limbs.size(); ++i) {
+        uint64_t carry = 0;
+        for (unsigned j = 0; j < b.limbs.size(); ++j) {
+            carry += uint64_t(a.limbs[i]) * b.limbs[j] + r.limbs[i + j];
+            r.limbs[i + j] = uint32_t(carry);
+            carry >>= 32;
+        }
+        r.limbs[i + b.limbs.size()] = uint32_t(carry);
+    }
+    r.trim();
+    return r;
+}
+
+BigUint pow2(unsigned n)
+{
+    return BigUint(1).shl(n);
+}
+
+BigUint pow5(unsigned n)
+{
+    BigUint r(1);
+    for (; n >= 13; n -= 13) {
+        r.mul_small(1220703125);    // 5^13
+    }
+    for (; n > 0; --n) {
+        r.mul_small(5);
+    }
+    return r;
+}
+
+// 10^i for i < 400, filled by main
+std::vector<BigUint> g_pow10;
+
+BigUint to_big(uint64_t v)  { return BigUint(v); }
+BigUint to_big(Uint96 v)    { return BigUint(v.hi).shl(32).add_small(v.lo); }
+
+// The exponent ranges of decompose()
+const int DOUBLE_MAX_EXP = 1023;
+const int DOUBLE_MIN_EXP = -1074;
+const int FLOAT_MAX_EXP = 127;
+const int FLOAT_MIN_EXP = -149;
+
+/** Computes the entry for the given step. If @a pos, the multiplier is
+    2^exp2/5^exp5 = 2^step/10^exp5, otherwise 5^exp5/2^exp2 = 10^exp5/2^step.
+    Returns false if the multiplier is not in [0.5, 1).
+*/
+bool make_desc(bool pos, unsigned step, DivDesc& desc)
+{
+    // exp5 is the smallest one with 10^exp5 > 2^step for pos, the largest one
+    // with 10^exp5 < 2^step otherwise. The estimate is corrected if needed.
+    int exp5 = int(std::floor(step * std::log10(2.0))) + (pos ? 1 : 0);
+    BigUint p2 = pow2(step);
+    for (;;) {
+        BigUint p10 = pow5(exp5).shl(exp5);
+        if (pos && compare(p10, p2) <= 0) {
+            exp5++;
+        } else if (!pos && compare(p10, p2) >= 0) {
+            exp5--;
+        } else if (pos && exp5 > 0 && compare(pow5(exp5 - 1).shl(exp5 - 1), p2) > 0) {
+            exp5--;
+        } else if (!pos && compare(pow5(exp5 + 1).shl(exp5 + 1), p2) < 0) {
+            exp5++;
+        } else {
+            break;
+        }
+    }
+    if (exp5 < 1 || unsigned(exp5) > step) {
+        return false;
+    }
+    desc.exp2 = step - exp5;
+    desc.exp5 = exp5;
+
+    BigUint a = pos ? pow2(desc.exp2) : pow5(desc.exp5);
+    BigUint b = pos ? pow5(desc.exp5) : pow2(desc.exp2);
+    // a/b in [0.5, 1)
+    if (compare(a, b) >= 0 || compare(BigUint(a).shl(1), b) < 0) {
+        return false;
+    }
+
+    // 96 bits of the quotient by long division
+    uint64_t hi = 0;
+    uint32_t lo = 0;
+    BigUint r = a;
+    for (unsigned i = 0; i < 96; ++i) {
+        r.shl(1);
+        unsigned bit = 0;
+        if (compare(r, b) >= 0) {
+            r.sub(b);
+            bit = 1;
+        }
+        hi = (hi << 1) | (lo >> 31);
+        lo = (lo << 1) | bit;
+    }
+    desc.cf1 = hi;
+    desc.cf2 = lo;
+    return true;
+}
+
+/** Checks that q is the truncated quotient a*2^bits/b, i.e. that
+    q*b <= a*2^bits < (q+1)*b. Independent of the division in make_desc.
+*/
+bool is_truncated_quotient(const BigUint& q, const BigUint& a, const BigUint& b,
+                           unsigned bits)
+{
+    BigUint scaled = BigUint(a).shl(bits);
+    BigUint q1 = q;
+    q1.add_small(1);
+    return compare(mul(q, b), scaled) <= 0 && compare(mul(q1, b), scaled) > 0;
+}
+
+/// Proves the truncation error of the constant of desc, see DivDesc
+bool check_desc(bool pos, const DivDesc& desc)
+{
+    BigUint a = pos ? pow2(desc.exp2) : pow5(desc.exp5);
+    BigUint b = pos ? pow5(desc.exp5) : pow2(desc.exp2);
+    Uint96 cf;
+    cf.hi = desc.cf1;
+    cf.lo = desc.cf2;
+    return (desc.cf1 >> 63) == 1 &&
+           is_truncated_quotient(to_big(cf), a, b, 96) &&
+           is_truncated_quotient(BigUint(desc.cf1), a, b, 64);
+}
+
+/// Returns the number of significant bits of a
+unsigned bit_length(const BigUint& a)
+{
+    if (a.limbs.empty()) {
+        return 0;
+    }
+    unsigned n = (a.limbs.size() - 1) * 32;
+    for (uint32_t top = a.limbs.back(); top != 0; top >>= 1) {
+        n++;
+    }
+    return n;
+}
+
+BigUint to_big(const Pow10Desc& p)
+{
+    return BigUint(p.hi).shl(32).add_small(uint32_t(p.lo >> 32)).shl(32)
+            .add_small(uint32_t(p.lo));
+}
+
+// The range of the exponents of shortest_pow10_desc: cf::to_chars looks up
+// 10^-k for k = floor(log10(2^q)) and the binary exponents q of double
+const int POW10_DESC_MIN = -292;
+const int POW10_DESC_MAX = 324;
+
+/** Computes the entry of shortest_pow10_desc for 10^k, see Pow10Desc. The
+    exact value is a*2^bits/b; the entry is the truncated quotient plus one.
+*/
+bool make_pow10_desc(int k, Pow10Desc& desc)
+{
+    BigUint a, b;
+    unsigned bits;
+    if (k >= 0) {
+        // 10^k in [2^(len-1), 2^len)
+        a = BigUint(g_pow10[k]);
+        unsigned len = bit_length(a);
+        b = pow2(len > 128 ? len - 128 : 0);
+        bits = len > 128 ? 0 : 128 - len;
+    } else {
+        // 10^-k in (2^(len-1), 2^len), thus 10^k in (2^-len, 2^(1-len))
+        a = BigUint(1);
+        b = g_pow10[-k];
+        bits = 127 + bit_length(b);
+    }
+
+    // 128 bits of the quotient by long division
+    BigUint r = BigUint(a).shl(bits);
+    desc.hi = desc.lo = 0;
+    for (int i = 127; i >= 0; --i) {
+        BigUint t = BigUint(b).shl(i);
+        if (compare(r, t) >= 0) {
+            r.sub(t);
+            if (i >= 64) {
+                desc.hi |= uint64_t(1) << (i - 64);
+            } else {
+                desc.lo |= uint64_t(1) << i;
+            }
+        }
+    }
+    if ((desc.hi >> 63) != 1 || !is_truncated_quotient(to_big(desc), a, b, bits)) {
+        return false;
+    }
+    if (++desc.lo == 0) {
+        desc.hi++;
+    }
+    return true;
+}
+
+void print_pow10_table(FILE* out)
+{
+    std::fprintf(out, "inline constexpr int shortest_pow10_min = %d;\n\n",
+                 POW10_DESC_MIN);
+    std::fprintf(out, "inline constexpr Pow10Desc shortest_pow10_desc[] = {\n");
+    for (int k = POW10_DESC_MIN; k <= POW10_DESC_MAX; ++k) {
+        Pow10Desc d;
+        make_pow10_desc(k, d);
+        std::fprintf(out, "    { 0x%016llx, 0x%016llx }, // 1e%d\n",
+                     (unsigned long long) d.hi, (unsigned long long) d.lo, k);
+    }
+    std::fprintf(out, "};\n");
+}
+
+struct Candidate {
+    std::string name;
+    std::vector<DivDesc> pos;
+    std::vector<DivDesc> neg;
+    double pos_muls;            // average number of multiplications
+    double neg_muls;
+    double err_bits_double;     // log2 of the worst certified error in ulp
+    double err_bits_float;
+    double ns_double;
+    double ns_float;
+    bool valid;
+};
+
+/// Returns the average number of multiplications over exponents [0, max_exp]
+double average_muls(const std::vector<unsigned>& steps, int max_exp)
+{
+    // steps are in decreasing order, thus reduce_exp always takes the largest
+    // step that fits
+    std::vector<unsigned> count(max_exp + 1, 0);
+    unsigned long long sum = 0;
+    for (int e = 0; e <= max_exp; ++e) {
+        for (unsigned i = 0; i < steps.size(); ++i) {
+            if (unsigned(e) >= steps[i]) {
+                count[e] = count[e - steps[i]] + 1;
+                break;
+            }
+        }
+        sum += count[e];
+    }
+    return double(sum) / (max_exp + 1);
+}
+
+/** Finds @a size steps out of @a usable that minimize the average number of
+    multiplications. The smallest step is always the smallest usable one.
+    Starts with a geometric series and improves one step at a time.
+*/
+std::vector<unsigned> search_steps(const std::vector<unsigned>& usable,
+                                   unsigned size, int max_exp)
+{
+    std::vector<unsigned> steps(size);
+    unsigned idx = usable.size();
+    for (unsigned i = 0; i < size; ++i) {
+        double target = std::pow(double(max_exp), double(size - i) / (size + 1));
+        unsigned pos = std::lower_bound(usable.begin(), usable.end(),
+                                        unsigned(target)) - usable.begin();
+        // keep the steps distinct and decreasing
+        pos = std::min(pos, idx - 1);
+        pos = std::max(pos, size - 1 - i);
+        steps[i] = usable[pos];
+        idx = pos;
+    }
+    steps[size - 1] = usable[0];
+
+    double best = average_muls(steps, max_exp);
+    for (unsigned pass = 0; pass < 20; ++pass) {
+        bool improved = false;
+        for (unsigned i = 0; i + 1 < size; ++i) {
+            unsigned lower = steps[i + 1];
+            unsigned upper = (i == 0) ? unsigned(max_exp) + 1 : steps[i - 1];
+            unsigned orig = steps[i];
+            for (unsigned s : usable) {
+                if (s <= lower || s >= upper || s == orig) {
+                    continue;
+                }
+                steps[i] = s;
+                double cost = average_muls(steps, max_exp);
+                if (cost < best) {
+                    best = cost;
+                    orig = s;
+                    improved = true;
+                }
+            }
+            steps[i] = orig;
+        }
+        if (!improved) {
+            break;
+        }
+    }
+    return steps;
+}
+
+std::vector<DivDesc> make_table(bool pos, const std::vector<unsigned>& steps)
+{
+    std::vector<DivDesc> table;
+    for (unsigned s : steps) {
+        DivDesc desc;
+        if (!make_desc(pos, s, desc) || !check_desc(pos, desc)) {
+            std::fprintf(stderr, "gentables: invalid step %u\n", s);
+            std::exit(1);
+        }
+        table.push_back(desc);
+    }
+    return table;
+}
+
+std::vector<unsigned> table_steps(const std::vector<DivDesc>& table)
+{
+    std::vector<unsigned> steps;
+    for (const DivDesc& d : table) {
+        steps.push_back(d.exp2 + d.exp5);
+    }
+    return steps;
+}
+
+double to_double(uint64_t v)    { return double(v); }
+double to_double(Uint96 v)      { return std::ldexp(double(v.hi), 32) + v.lo; }
+
+uint64_t make_signif(uint64_t, uint64_t m53) { return m53 << 11; }
+Uint96 make_signif(Uint96, uint64_t m53)
+{
+    Uint96 r;
+    r.hi = m53 << 11;
+    r.lo = 0;
+    return r;
+}
+
+uint64_t g_lcg_state = 0x853c49e6748fea9bULL;
+
+uint64_t next_random()
+{
+    g_lcg_state = g_lcg_state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return g_lcg_state >> 11;
+}
+
+/// Random significand with the MSB set and the precision of double or float
+template<class U>
+U random_signif(unsigned precision)
+{
+    uint64_t m = next_random() | (1ull << 52);
+    m &= ~((1ull << (53 - precision)) - 1);
+    return make_signif(U(), m);
+}
+
+/** Reduces all exponents in [min_exp, max_exp] with the tables of @a c and
+    checks that the exact value lies within the certified error. Returns log2
+    of the largest error or -1 if a check fails.
+*/
+template<class U>
+double check_reduction(const Candidate& c, int min_exp, int max_exp,
+                       unsigned precision)
+{
+    double max_err = 0;
+    for (int e = min_exp; e <= max_exp; ++e) {
+        for (unsigned k = 0; k < 4; ++k) {
+            U m;
+            if (k == 0) {
+                m = make_signif(U(), 1ull << 52);
+            } else if (k == 1) {
+                m = make_signif(U(), ((1ull << 53) - 1) & ~((1ull << (53 - precision)) - 1));
+            } else {
+                m = random_signif<U>(precision);
+            }
+            U s = m;
+            U err = make_signif_digit(s, 0);
+            int exp10 = 0;
+            reduce_exp_desc(s, err, e, exp10, c.pos.data(), c.pos.size(),
+                            c.neg.data(), c.neg.size());
+
+            unsigned digit = extract_signif_digit(s);
+            if (digit < 1 || digit > 9) {
+                return -1;
+            }
+            // m*2^(e-(w-1)) must be in [s, s + err] * 2^-(w-4) * 10^exp10,
+            // i.e. s*10^exp10 <= m*2^(e-3) <= (s + err)*10^exp10
+            BigUint lo = to_big(s);
+            BigUint hi = to_big(add(s, err));
+            BigUint exact = to_big(m);
+            if (exp10 >= 0) {
+                lo = mul(lo, g_pow10[exp10]);
+                hi = mul(hi, g_pow10[exp10]);
+            } else {
+                exact = mul(exact, g_pow10[-exp10]);
+            }
+            if (e >= 3) {
+                exact.shl(e - 3);
+            } else {
+                lo.shl(3 - e);
+                hi.shl(3 - e);
+            }
+            if (compare(lo, exact) > 0 || compare(hi, exact) < 0) {
+                return -1;
+            }
+            max_err = std::max(max_err, to_double(err));
+        }
+    }
+    return max_err > 0 ? std::log2(max_err) : 0;
+}
+
+volatile unsigned g_sink;
+
+/// Returns the time of reduce_exp_desc with the tables of @a c in ns
+template<class U>
+__attribute__((noinline))
+double bench(const Candidate& c, const std::vector<U>& signifs,
+             const std::vector<int>& exps, unsigned repeat)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    unsigned sum = 0;
+    for (unsigned r = 0; r < repeat; ++r) {
+        for (unsigned i = 0; i < signifs.size(); ++i) {
+            U s = signifs[i];
+            U err = make_signif_digit(s, 0);
+            int exp10 = 0;
+            reduce_exp_desc(s, err, exps[i], exp10, c.pos.data(),
+                            c.pos.size(), c.neg.data(), c.neg.size());
+            sum += exp10 + unsigned(signif_hi(s));
+        }
+    }
+    double time = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+    g_sink = sum;
+    return time * 1e9 / (double(repeat) * signifs.size());
+}
+
+void print_table(FILE* out, const char* name, const std::vector<DivDesc>& table)
+{
+    std::fprintf(out, "inline constexpr DivDesc %s[] = {\n", name);
+    for (const DivDesc& d : table) {
+        std::fprintf(out, "    {%3u, %3u, 0x%016llx, 0x%08x },\n", d.exp2, d.exp5,
+                     (unsigned long long) d.cf1, d.cf2);
+    }
+    std::fprintf(out, "};\n");
+}
+
+void usage()
+{
+    std::fprintf(stderr,
+            "usage: gentables [-o file] [-c bytes] [-r count] [-e bits] [-v]\n");
+    std::exit(1);
+}
+
+int main(int argc, char** argv)
+{
+    const char* out_name = NULL;
+    unsigned max_bytes = 2048;
+    unsigned repeat = 64;
+    double max_err_double = -1;
+    double max_err_float = -1;
+    bool verbose = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "o:c:r:e:v")) != -1) {
+        switch (opt) {
+        case 'o': out_name = optarg; break;
+        case 'c': max_bytes = std::atoi(optarg); break;
+        case 'r': repeat = std::max(1, std::atoi(optarg)); break;
+        case 'e': max_err_double = max_err_float = std::atof(optarg); break;
+        case 'v': verbose = true; break;
+        default: usage();
+        }
+    }
+    if (optind != argc) {
+        usage();
+    }
+
+    g_pow10.push_back(BigUint(1));
+    for (unsigned i = 1; i < 400; ++i) {
+        g_pow10.push_back(BigUint(g_pow10.back()).mul_small(10));
+    }
+
+    // usable steps in increasing order
+    std::vector<unsigned> pos_usable, neg_usable;
+    for (int s = 1; s <= DOUBLE_MAX_EXP; ++s) {
+        DivDesc desc;
+        if (make_desc(true, s, desc)) {
+            pos_usable.push_back(s);
+        }
+    }
+    for (int s = 1; s <= -DOUBLE_MIN_EXP; ++s) {
+        DivDesc desc;
+        if (make_desc(false, s, desc)) {
+            neg_usable.push_back(s);
+        }
+    }
+
+    std::vector<Candidate> cands;
+    Candidate current;
+    current.name = "current";
+    current.pos.assign(mul2div5_desc, mul2div5_desc + sizeof(mul2div5_desc)/sizeof(*mul2div5_desc));
+    current.neg.assign(mul5div2_desc, mul5div2_desc + sizeof(mul5div2_desc)/sizeof(*mul5div2_desc));
+    cands.push_back(current);
+
+    const unsigned sizes[] = { 2, 3, 4, 5, 6, 7, 8, 10, 12, 16, 20, 24, 32, 40, 48, 64 };
+    for (unsigned size : sizes) {
+        if (2 * size * sizeof(DivDesc) > max_bytes) {
+            break;
+        }
+        Candidate c;
+        c.name = std::to_string(size) + " entries";
+        c.pos = make_table(true, search_steps(pos_usable, size, DOUBLE_MAX_EXP));
+        c.neg = make_table(false, search_steps(neg_usable, size, -DOUBLE_MIN_EXP));
+        cands.push_back(c);
+    }
+
+    // benchmark input: random significands with uniformly distributed exponents
+    const unsigned count = 4096;
+    std::vector<Uint96> signifs96(count);
+    std::vector<uint64_t> signifs64(count);
+    std::vector<int> exps96(count), exps64(count);
+    for (unsigned i = 0; i < count; ++i) {
+        signifs96[i] = random_signif<Uint96>(53);
+        signifs64[i] = random_signif<uint64_t>(24);
+        exps96[i] = DOUBLE_MIN_EXP + int(next_random() % (DOUBLE_MAX_EXP - DOUBLE_MIN_EXP + 1));
+        exps64[i] = FLOAT_MIN_EXP + int(next_random() % (FLOAT_MAX_EXP - FLOAT_MIN_EXP + 1));
+    }
+
+    for (Candidate& c : cands) {
+        c.valid = true;
+        for (unsigned i = 0; i < c.pos.size(); ++i) {
+            c.valid = c.valid && check_desc(true, c.pos[i]);
+        }
+        for (unsigned i = 0; i < c.neg.size(); ++i) {
+            c.valid = c.valid && check_desc(false, c.neg[i]);
+        }
+        c.pos_muls = average_muls(table_steps(c.pos), DOUBLE_MAX_EXP);
+        c.neg_muls = average_muls(table_steps(c.neg), -DOUBLE_MIN_EXP);
+        c.err_bits_double = check_reduction<Uint96>(c, DOUBLE_MIN_EXP, DOUBLE_MAX_EXP, 53);
+        c.err_bits_float = check_reduction<uint64_t>(c, FLOAT_MIN_EXP, FLOAT_MAX_EXP, 24);
+        if (c.err_bits_double < 0 || c.err_bits_float < 0) {
+            c.valid = false;
+        }
+        c.ns_double = c.ns_float = 1e30;
+    }
+
+    // the candidates are measured in turns and the best time of each is kept,
+    // so that a slow period of the machine does not penalize one of them
+    for (unsigned round = 0; round < 7; ++round) {
+        for (Candidate& c : cands) {
+            c.ns_double = std::min(c.ns_double, bench(c, signifs96, exps96, repeat));
+            c.ns_float = std::min(c.ns_float, bench(c, signifs64, exps64, repeat));
+        }
+    }
+
+    if (!cands[0].valid) {
+        std::fprintf(stderr, "gentables: the current tables fail the checks\n");
+        return 1;
+    }
+    for (int k = POW10_DESC_MIN; k <= POW10_DESC_MAX; ++k) {
+        Pow10Desc desc;
+        if (!make_pow10_desc(k, desc)) {
+            std::fprintf(stderr, "gentables: the power of ten table fails the checks\n");
+            return 1;
+        }
+    }
+    if (max_err_double < 0) {
+        max_err_double = cands[0].err_bits_double;
+        max_err_float = cands[0].err_bits_float;
+    }
+
+    const Candidate* best = &cands[0];
+    for (const Candidate& c : cands) {
+        if (verbose) {
+            std::fprintf(stderr, "%-12s %5u bytes  muls %5.2f %5.2f  err bits %5.2f %5.2f"
+                         "  double %6.2f ns  float %6.2f ns%s\n",
+                         c.name.c_str(),
+                         unsigned((c.pos.size() + c.neg.size()) * sizeof(DivDesc)),
+                         c.pos_muls, c.neg_muls, c.err_bits_double,
+                         c.err_bits_float, c.ns_double, c.ns_float,
+                         c.valid ? "" : "  INVALID");
+        }
+        // a candidate must be clearly faster to be preferred over the
+        // smaller tables, otherwise the result depends on the timing noise
+        if (c.valid && c.err_bits_double <= max_err_double &&
+                c.err_bits_float <= max_err_float &&
+                c.ns_double + c.ns_float <
+                0.97 * (best->ns_double + best->ns_float)) {
+            best = &c;
+        }
+    }
+
+    FILE* out = stdout;
+    if (out_name) {
+        out = std::fopen(out_name, "w");
+        if (!out) {
+            std::perror(out_name);
+            return 1;
+        }
+    }
+    std::fprintf(out,
+            "/*  Generated by gentables, do not edit. Regenerate with 'make tables'.\n"
+            "    Included by cformat_impl.h inside namespace cformat_detail.\n"
+            "\n"
+            "    %u + %u entries, %u bytes. Average multiplications per value: %.2f for\n"
+            "    positive and %.2f for negative exponents. Largest certified error of\n"
+            "    the reduction: 2^%.1f ulp for double, 2^%.1f ulp for float.\n"
+            "\n"
+            "    shortest_pow10_desc holds 10^k for k in [%d, %d], see Pow10Desc.\n"
+            "*/\n\n",
+            unsigned(best->pos.size()), unsigned(best->neg.size()),
+            unsigned((best->pos.size() + best->neg.size()) * sizeof(DivDesc)),
+            best->pos_muls, best->neg_muls, best->err_bits_double,
+            best->err_bits_float, POW10_DESC_MIN, POW10_DESC_MAX);
+    print_table(out, "mul2div5_desc", best->pos);
+    std::fprintf(out, "\n");
+    print_table(out, "mul5div2_desc", best->neg);
+    std::fprintf(out, "\n");
+    print_pow10_table(out);
+    if (out != stdout) {
+        std::fclose(out);
+    }
+    std::fprintf(stderr, "gentables: selected %s, %.2f ns per double, %.2f ns per float"
+                 " (current: %.2f, %.2f)\n", best->name.c_str(), best->ns_double,
+                 best->ns_float, cands[0].ns_double, cands[0].ns_float);
+    return 0;
+}
@@ -19,10 +19,34 @@
 #include <iostream>
 #include <cstdio>
 #include <sstream>
+#include <vector>
+#include <charconv>
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+#include <limits>
 
 #include "cformat.h"
+// If TEST_INLINE is set, TEST_CF and TEST_CMP use the header-only formatter
+#if TEST_INLINE
+#include "cformat_inline.h"
+#endif
+#if TEST_CF_ASYNC
+#include "cformat_async.h"
+#endif
+#if TEST_LATENCY || TEST_MATRIX || TEST_ROWS
+#include <chrono>
+#endif
+#if TEST_LATENCY
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
 
+// Set TEST_DOUBLE to 0 to test floats
+#ifndef TEST_DOUBLE
 #define TEST_DOUBLE 1
+#endif
 unsigned long long g_test_count = 20000000;
 
 /* The values for testing are computed effectively as follows:
@@ -46,6 +70,35 @@ T g_min = 1e-30;
 T g_max = 1e30;
 #endif
 
+// The tested format is %.17e by default. If TEST_HEX is set, %a is tested
+// instead, if TEST_PRICES is set, %.2f. TEST_PREC overrides the precision, -1
+// means no precision.
+#if TEST_HEX
+#define TEST_FLAGS FLAG_FLT_HEX
+#define TEST_CONV 'a'
+#ifndef TEST_PREC
+#define TEST_PREC -1
+#endif
+#elif TEST_PRICES
+#define TEST_FLAGS FLAG_FLT_NOR
+#define TEST_CONV 'f'
+#ifndef TEST_PREC
+#define TEST_PREC 2
+#endif
+#elif TEST_FP16 || TEST_BF16
+#define TEST_FLAGS FLAG_FLT_EXP
+#define TEST_CONV 'e'
+#ifndef TEST_PREC
+#define TEST_PREC 4
+#endif
+#else
+#define TEST_FLAGS FLAG_FLT_EXP
+#define TEST_CONV 'e'
+#ifndef TEST_PREC
+#define TEST_PREC 17
+#endif
+#endif
+
 // The following values are arbitrary
 T g_start = 1.123123123123123123123;
 T g_mul = 1.5000203040203040203020304;
@@ -53,9 +106,775 @@ T g_mul_loop = 1.00001000000015656562;
 
 volatile T g_dummy_store;
 
+/*  If TEST_ZIPF is set, the values are instead taken from a set of
+    g_zipf_distinct values that follow a Zipf distribution with exponent 1,
+    i.e. the k-th most common value appears with probability proportional to
+    1/k. This models streams that repeat a small set of values heavily. The
+    distinct values are the first values of the default sequence. A table of
+    samples is generated at startup and reused cyclically.
+
+    If TEST_PRICES is set, the values are prices with two decimal places
+    between 0.01 and 100000.00, i.e. random integers divided by 100.
+*/
+unsigned g_zipf_distinct = 1000;
+#define INPUT_TABLE_SIZE (1 << 20)
+T g_input_table[INPUT_TABLE_SIZE];
+
+// simple 64-bit LCG, the quality is sufficient for sampling
+unsigned long long g_lcg_state = 0x853c49e6748fea9bULL;
+
+unsigned long long next_random()
+{
+    g_lcg_state = g_lcg_state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return g_lcg_state >> 11;
+}
+
+void init_zipf_table()
+{
+    std::vector<T> distinct(g_zipf_distinct);
+    std::vector<double> cdf(g_zipf_distinct);
+    T v = g_start;
+    double sum = 0;
+    for (unsigned k = 0; k < g_zipf_distinct; ++k) {
+        distinct[k] = v;
+        v *= g_mul;
+        sum += 1.0 / (k + 1);
+        cdf[k] = sum;
+    }
+    for (unsigned i = 0; i < INPUT_TABLE_SIZE; ++i) {
+        double r = double(next_random()) / double(1ULL << 53) * sum;
+        unsigned k = std::lower_bound(cdf.begin(), cdf.end(), r) - cdf.begin();
+        g_input_table[i] = distinct[std::min(k, g_zipf_distinct - 1)];
+    }
+}
+
+void init_prices_table()
+{
+    for (unsigned i = 0; i < INPUT_TABLE_SIZE; ++i) {
+        g_input_table[i] = T(next_random() % 10000000 + 1) / 100;
+    }
+}
+
+/*  If TEST_LATENCY is set, the duration of each formatting call as seen by
+    the calling thread is measured and the percentiles are printed to stderr.
+    The calls are separated by g_latency_gap time units of busy waiting, which
+    models a thread that does other work in between, so that the background
+    thread of TEST_CF_ASYNC can keep up. The unit is cycles on x86 and
+    nanoseconds elsewhere.
+*/
+#if TEST_LATENCY
+unsigned long long g_latency_gap = 2000;
+#define LATENCY_HIST_SIZE (1 << 16)
+unsigned long long g_latency_hist[LATENCY_HIST_SIZE];
+
+inline unsigned long long latency_now()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+void print_latency_percentile(const char* name, double q)
+{
+    unsigned long long total = 0;
+    for (unsigned i = 0; i < LATENCY_HIST_SIZE; ++i) {
+        total += g_latency_hist[i];
+    }
+    unsigned long long target = total * q;
+    unsigned long long acc = 0;
+    unsigned i = 0;
+    for (; i < LATENCY_HIST_SIZE - 1; ++i) {
+        acc += g_latency_hist[i];
+        if (acc > target) {
+            break;
+        }
+    }
+    std::cerr << name << ": " << i << (i == LATENCY_HIST_SIZE - 1 ? "+" : "")
+              << "  ";
+}
+#endif
+
+/*  TEST_CF_WIDE formats to a buffer of TEST_CHAR_T directly, TEST_CF_WIDEN
+    formats to a char buffer and then converts it to TEST_CHAR_T. Both write
+    the raw code units to stdout, so the outputs are comparable.
+*/
+#if TEST_CF_WIDE || TEST_CF_WIDEN
+#ifndef TEST_CHAR_T
+#define TEST_CHAR_T char16_t
+#endif
+typedef TEST_CHAR_T WideChar;
+#endif
+
 #define BUFSIZE 1024000
 char g_buf[BUFSIZE];
 
+/*  If TEST_FP16 or TEST_BF16 is set, Float16 or BFloat16 values are tested
+    instead. All 65536 bit patterns are visited in a scrambled order, in
+    batches of HALF_BATCH values. The default format is %.4e, i.e. the 5
+    significant digits that are enough for Float16. TEST_CF formats each batch
+    with print_float10_batch, TEST_CF_PROMOTE converts the batch to float
+    first. TEST_CMP compares all values with snprintf in several formats and
+    exits.
+*/
+#if TEST_FP16 || TEST_BF16
+#if TEST_FP16
+typedef Float16 Half;
+#else
+typedef BFloat16 Half;
+#endif
+#define HALF_BATCH 1024
+Half g_half_input[65536];
+
+int test_half(const FmtInfo& fmt, const char* test_fmt, const char* test_fmt_nl)
+{
+    for (unsigned i = 0; i < 65536; ++i) {
+        g_half_input[i].bits = uint16_t(i * 40503);
+    }
+    static char buf[HALF_BATCH * 64];
+#if TEST_CMP
+    (void) test_fmt;
+    (void) test_fmt_nl;
+    const char* cmp_fmts[] = {
+        "%.4e", "%.17e", "%.0e", "%e", "%.3f", "%f", "%.30f", "%g", "%.5g",
+        "%.12g", "%#.4g", "%+10.2e", "%-12.3f", "%a", "%.1a", "%.20g", "%.25g"
+    };
+    unsigned cmp_flags[] = {
+        FLAG_FLT_EXP, FLAG_FLT_EXP, FLAG_FLT_EXP, FLAG_FLT_EXP, FLAG_FLT_NOR,
+        FLAG_FLT_NOR, FLAG_FLT_NOR, 0, 0, 0, FLAG_ALT, FLAG_FLT_EXP | FLAG_SIGN,
+        FLAG_FLT_NOR | FLAG_LEFT, FLAG_FLT_HEX, FLAG_FLT_HEX, 0, 0
+    };
+    int cmp_width[] = { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 10, 12, -1, -1, -1, -1 };
+    int cmp_prec[] = { 4, 17, 0, -1, 3, -1, 30, -1, 5, 12, 4, 2, 3, -1, 1, 20, 25 };
+    unsigned long long succ = 0;
+    unsigned long long fail = 0;
+
+    // glibc drops the zeros that %#g keeps when the rounding carries into the
+    // next power of ten, e.g. %#.3g of 999.5 gives 1.e+03 instead of 1.00e+03.
+    // These cases are checked against the expected strings instead
+#if TEST_FP16
+    const uint16_t carry_bits[] = { 0x63cf, 0xe3cf };   // 999.5, -999.5
+    const char* carry_fmt = "%#.3g";
+    int carry_prec = 3;
+    const char* carry_expected[] = { "1.00e+03", "-1.00e+03" };
+#else
+    const uint16_t carry_bits[] = { 0x42c7, 0xc2c7 };   // 99.5, -99.5
+    const char* carry_fmt = "%#.2g";
+    int carry_prec = 2;
+    const char* carry_expected[] = { "1.0e+02", "-1.0e+02" };
+#endif
+    for (unsigned i = 0; i < 2; ++i) {
+        Half val;
+        val.bits = carry_bits[i];
+        char* end = print_float10(buf, buf + sizeof(buf), FLAG_ALT, -1,
+                                  carry_prec, fmt, val, carry_fmt);
+        if (std::string(buf, end) == carry_expected[i]) {
+            succ++;
+        } else {
+            std::cout << carry_fmt << " " << val.bits << "\n"
+                      << carry_expected[i] << "\n" << std::string(buf, end)
+                      << "\n";
+            fail++;
+        }
+    }
+
+    for (unsigned i = 0; i < 65536; ++i) {
+        Half val = g_half_input[i];
+        for (unsigned j = 0; j < sizeof(cmp_fmts) / sizeof(*cmp_fmts); ++j) {
+            char a[256];
+            unsigned count = std::snprintf(a, sizeof(a), cmp_fmts[j],
+                                           to_float(val));
+            char* end = print_float10(buf, buf + sizeof(buf), cmp_flags[j],
+                                      cmp_width[j], cmp_prec[j], fmt, val,
+                                      cmp_fmts[j]);
+            if (std::string(a, count) == std::string(buf, end)) {
+                succ++;
+            } else {
+                std::cout << cmp_fmts[j] << " " << val.bits << "\n" << a
+                          << "\n" << std::string(buf, end) << "\n";
+                fail++;
+            }
+        }
+    }
+    std::cout << "Fail: " << fail << "\n"
+              << "Success: " << succ << "\n";
+#else
+    unsigned flags = TEST_FLAGS;
+#if TEST_LIBC
+    (void) flags;
+    (void) buf;
+    (void) fmt;
+#endif
+    for (unsigned long long i = 0; i < g_test_count; i += HALF_BATCH) {
+        const Half* vals = g_half_input + i % 65536;
+#if TEST_LIBC
+        for (unsigned j = 0; j < HALF_BATCH; ++j) {
+            std::printf(test_fmt_nl, to_float(vals[j]));
+        }
+#elif TEST_CF
+        char* end = print_float10_batch(buf, buf + sizeof(buf), flags, -1,
+                                        TEST_PREC, fmt, vals, HALF_BATCH, '\n',
+                                        test_fmt);
+        std::cout.write(buf, end - buf);
+#elif TEST_CF_PROMOTE
+        float fvals[HALF_BATCH];
+        for (unsigned j = 0; j < HALF_BATCH; ++j) {
+            fvals[j] = to_float(vals[j]);
+        }
+        char* end = print_float10_batch(buf, buf + sizeof(buf), flags, -1,
+                                        TEST_PREC, fmt, fvals, HALF_BATCH, '\n',
+                                        test_fmt);
+        std::cout.write(buf, end - buf);
+#endif
+    }
+#endif
+    return 0;
+}
+#endif
+
+/*  If TEST_MATRIX is set, a MATRIX_ROWS x MATRIX_COLS matrix is printed as an
+    aligned table with a different format in each column. TEST_CF uses
+    matrix_column_widths and print_float10_matrix. TEST_LIBC formats each
+    value with snprintf twice, once to find the column widths and once to
+    print it. The rows per second are printed to stderr. TEST_CMP compares the
+    two tables for two sets of formats, using values that are close to powers
+    of ten and to the rounding thresholds in addition to random ones.
+*/
+#if TEST_MATRIX
+#define MATRIX_ROWS 1000000
+#define MATRIX_COLS 8
+
+struct MatrixFormat {
+    const char* measure_fmt;    // printf format without the width
+    const char* print_fmt;      // printf format that takes the width
+    ColumnSpec spec;
+    double scale;               // of the random values
+};
+
+MatrixFormat g_matrix_formats[MATRIX_COLS] = {
+    { "%.2f",   "%*.2f",   { FLAG_FLT_NOR, -1, 2 }, 1e4 },
+    { "%.6f",   "%*.6f",   { FLAG_FLT_NOR, -1, 6 }, 1 },
+    { "%.3e",   "%*.3e",   { FLAG_FLT_EXP, -1, 3 }, 1e6 },
+    { "%.10e",  "%*.10e",  { FLAG_FLT_EXP, -1, 10 }, 1e-3 },
+    { "%.4f",   "%*.4f",   { FLAG_FLT_NOR, -1, 4 }, 1e2 },
+    { "%+.1f",  "%+*.1f",  { FLAG_FLT_NOR | FLAG_SIGN, -1, 1 }, 1e7 },
+    { "%.17e",  "%*.17e",  { FLAG_FLT_EXP, -1, 17 }, 1e200 },
+    { "%.0f",   "%*.0f",   { FLAG_FLT_NOR, -1, 0 }, 1e5 },
+};
+
+#if TEST_CMP
+// The flags and the formats that always need formatting to measure
+MatrixFormat g_matrix_formats_cmp[MATRIX_COLS] = {
+    { "%g",     "%*g",     { 0, -1, -1 }, 1e10 },
+    { "%-.3f",  "%-*.3f",  { FLAG_FLT_NOR | FLAG_LEFT, -1, 3 }, 1e3 },
+    { "%#.0e",  "%#*.0e",  { FLAG_FLT_EXP | FLAG_ALT, -1, 0 }, 1e100 },
+    { "% .2E",  "% *.2E",  { FLAG_FLT_EXP | FLAG_SPACE | FLAG_UPPERCASE, -1, 2 }, 1e-100 },
+    { "%0.3f",  "%0*.3f",  { FLAG_FLT_NOR | FLAG_ZERO, 12, 3 }, 1e8 },
+    { "%a",     "%*a",     { FLAG_FLT_HEX, -1, -1 }, 1 },
+    { "%.25f",  "%*.25f",  { FLAG_FLT_NOR, -1, 25 }, 1e-5 },
+    { "%.30e",  "%*.30e",  { FLAG_FLT_EXP, -1, 30 }, 1e-300 },
+};
+#endif
+
+double g_random_double()
+{
+    return double(next_random()) / double(1ULL << 53);
+}
+
+/*  Returns a random value of the column. For TEST_CMP, also values close to
+    powers of ten, to the thresholds where %f gains an integer digit and to
+    the thresholds where %e gets a three-digit exponent.
+*/
+double matrix_value(const MatrixFormat& f)
+{
+    double sign = (next_random() & 1) ? -1 : 1;
+#if TEST_CMP
+    int prec = (f.spec.prec < 0) ? 6 : f.spec.prec;
+    int k = int(next_random() % 620) - 310;
+    double ulps = double(int(next_random() % 7) - 3) * 0x1p-52;
+    switch (next_random() % 5) {
+    case 1:
+        return sign * (1 + 9 * g_random_double()) * std::pow(10.0, k);
+    case 2:
+        return sign * std::pow(10.0, k) * (1 + ulps);
+    case 3:
+        k = next_random() % 25;
+        return sign * (std::pow(10.0, k) - 0.5 * std::pow(10.0, -prec)) * (1 + ulps);
+    case 4:
+        k = (next_random() & 1) ? 100 : -99;
+        return sign * std::pow(10.0, k) * (1 - 0.05 * std::pow(10.0, -prec)) * (1 + ulps);
+    }
+#endif
+    return sign * g_random_double() * f.scale;
+}
+
+// Formats the table as TEST_LIBC does, returns the end of the output
+char* libc_matrix(std::vector<char>& out, const MatrixFormat* formats,
+                  const double* vals)
+{
+    int widths[MATRIX_COLS];
+    for (unsigned c = 0; c < MATRIX_COLS; ++c) {
+        widths[c] = std::max(formats[c].spec.width, 0);
+    }
+    for (unsigned r = 0; r < MATRIX_ROWS; ++r) {
+        for (unsigned c = 0; c < MATRIX_COLS; ++c) {
+            int len = std::snprintf(NULL, 0, formats[c].measure_fmt,
+                                    vals[r * MATRIX_COLS + c]);
+            widths[c] = std::max(widths[c], len);
+        }
+    }
+    std::size_t row_len = MATRIX_COLS;
+    for (unsigned c = 0; c < MATRIX_COLS; ++c) {
+        row_len += widths[c];
+    }
+    // snprintf needs space for the terminating null character
+    out.resize(row_len * MATRIX_ROWS + 1);
+    char* p = out.data();
+    for (unsigned r = 0; r < MATRIX_ROWS; ++r) {
+        for (unsigned c = 0; c < MATRIX_COLS; ++c) {
+            p += std::snprintf(p, out.data() + out.size() - p,
+                               formats[c].print_fmt, widths[c],
+                               vals[r * MATRIX_COLS + c]);
+            *p++ = (c + 1 == MATRIX_COLS) ? '\n' : ' ';
+        }
+    }
+    return p;
+}
+
+// Formats the table as TEST_CF does, returns the end of the output
+char* cf_matrix(std::vector<char>& out, const FmtInfo& fmt,
+                const MatrixFormat* formats, const double* vals,
+                double& widths_time)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    ColumnSpec specs[MATRIX_COLS];
+    for (unsigned c = 0; c < MATRIX_COLS; ++c) {
+        specs[c] = formats[c].spec;
+    }
+    int widths[MATRIX_COLS];
+    std::size_t size = matrix_column_widths(specs, fmt, vals, MATRIX_ROWS,
+                                            MATRIX_COLS, widths);
+    widths_time = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+    out.resize(size);
+    return print_float10_matrix(out.data(), out.data() + out.size(), specs,
+                                widths, fmt, vals, MATRIX_ROWS, MATRIX_COLS,
+                                ' ');
+}
+
+int test_matrix(const FmtInfo& fmt)
+{
+#if TEST_CMP
+    unsigned long long succ = 0;
+    unsigned long long fail = 0;
+    MatrixFormat* format_sets[] = { g_matrix_formats, g_matrix_formats_cmp };
+    for (unsigned set = 0; set < 2; ++set) {
+        const MatrixFormat* formats = format_sets[set];
+        std::vector<double> vals(MATRIX_ROWS * MATRIX_COLS);
+        for (unsigned i = 0; i < vals.size(); ++i) {
+            vals[i] = matrix_value(formats[i % MATRIX_COLS]);
+        }
+        std::vector<char> a, b;
+        double widths_time;
+        char* a_end = libc_matrix(a, formats, vals.data());
+        char* b_end = cf_matrix(b, fmt, formats, vals.data(), widths_time);
+        if (b_end == NULL) {
+            std::cout << "print_float10_matrix overflow\n";
+            fail++;
+            continue;
+        }
+        // compare row by row
+        const char* pa = a.data();
+        const char* pb = b.data();
+        for (unsigned r = 0; r < MATRIX_ROWS; ++r) {
+            const char* na = std::find(pa, (const char*) a_end, '\n');
+            const char* nb = std::find(pb, (const char*) b_end, '\n');
+            if (std::string(pa, na) == std::string(pb, nb)) {
+                succ++;
+            } else {
+                std::cout << std::string(pa, na) << "\n"
+                          << std::string(pb, nb) << "\n";
+                fail++;
+            }
+            pa = std::min(na + 1, (const char*) a_end);
+            pb = std::min(nb + 1, (const char*) b_end);
+        }
+    }
+    std::cout << "Fail: " << fail << "\n"
+              << "Success: " << succ << "\n";
+#else
+    std::vector<double> vals(MATRIX_ROWS * MATRIX_COLS);
+    for (unsigned i = 0; i < vals.size(); ++i) {
+        vals[i] = matrix_value(g_matrix_formats[i % MATRIX_COLS]);
+    }
+    std::vector<char> out;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+#if TEST_LIBC
+    char* end = libc_matrix(out, g_matrix_formats, vals.data());
+#elif TEST_CF
+    double widths_time;
+    char* end = cf_matrix(out, fmt, g_matrix_formats, vals.data(), widths_time);
+#endif
+    double time = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+    std::cout.write(out.data(), end - out.data());
+    std::cerr << "Matrix " << MATRIX_ROWS << " x " << MATRIX_COLS << ": "
+              << MATRIX_ROWS / time << " rows/s";
+#if TEST_CF
+    std::cerr << ", widths " << widths_time << " s of " << time << " s";
+#endif
+    std::cerr << "\n";
+#endif
+    return 0;
+}
+#endif
+
+/*  If TEST_ROWS is set, ROWS_COUNT records of ROW_COLS doubles are serialized
+    as JSON lines and as CSV with a decimal comma. TEST_CF uses
+    print_float10_row. TEST_LIBC uses a hand-written serializer that formats
+    each value with snprintf and fixes up the output. The rows per second are
+    printed to stderr. TEST_CMP compares the two: fixed precision fields must
+    be identical, shortest fields must parse to the value and be no longer
+    than the libc ones. It also checks the JSON number grammar, the key
+    escaping and NONFINITE_ERROR.
+*/
+#if TEST_ROWS
+#define ROWS_COUNT 1000000
+#define ROW_COLS 6
+
+RowColumn g_row_cols[ROW_COLS] = {
+    { "price", 2 },
+    { "qty", 0 },
+    { "ratio", -1 },
+    { "temp", 1 },
+    { "score", -1 },
+    { "weight", 6 },
+};
+
+double g_row_scales[ROW_COLS] = { 1e4, 1e3, 1, 1e2, 1e6, 1e2 };
+
+RowSpec g_row_specs[] = {
+    { ROW_JSON, NONFINITE_NULL, '.', ',' },
+    { ROW_CSV, NONFINITE_NULL, ',', ',' },
+#if TEST_CMP
+    { ROW_JSON, NONFINITE_STRING, '.', ',' },
+    { ROW_CSV, NONFINITE_STRING, '.', ';' },
+#endif
+};
+
+/*  Returns a random value of the column, one in 1024 is not finite. For
+    TEST_CMP, also values over the whole range of double.
+*/
+double row_value(unsigned col)
+{
+    double sign = (next_random() & 1) ? -1 : 1;
+    double r = double(next_random()) / double(1ULL << 53);
+    switch (next_random() % 1024) {
+    case 0: return sign * INFINITY;
+    case 1: return NAN;
+    }
+#if TEST_CMP
+    if (next_random() % 4 == 0) {
+        int k = int(next_random() % 600) - 300;
+        return sign * (1 + 9 * r) * std::pow(10.0, k);
+    }
+#endif
+    return sign * r * g_row_scales[col];
+}
+
+// Serializes the record as TEST_LIBC does, returns the end of the output
+char* libc_row(char* p, char* last, const RowSpec& spec, const double* vals)
+{
+    bool json = spec.format == ROW_JSON;
+    if (json) {
+        *p++ = '{';
+    }
+    for (unsigned c = 0; c < ROW_COLS; ++c) {
+        if (c != 0) {
+            *p++ = json ? ',' : spec.sep;
+        }
+        if (json) {
+            p += std::snprintf(p, last - p, "\"%s\":", g_row_cols[c].key);
+        }
+        double v = vals[c];
+        if (!std::isfinite(v)) {
+            if (spec.nonfinite == NONFINITE_STRING) {
+                const char* str = std::isnan(v) ? "nan" : (v < 0 ? "-inf" : "inf");
+                p += std::snprintf(p, last - p, json ? "\"%s\"" : "%s", str);
+            } else if (json) {
+                p += std::snprintf(p, last - p, "null");
+            }
+            continue;
+        }
+        char* start = p;
+        int prec = g_row_cols[c].prec;
+        if (prec < 0) {
+            // the first of %.15g, %.16g and %.17g that round-trips
+            for (prec = 15; prec <= 17; ++prec) {
+                int n = std::snprintf(p, last - p, "%.*g", prec, v);
+                if (prec == 17 || std::strtod(p, NULL) == v) {
+                    p += n;
+                    break;
+                }
+            }
+        } else {
+            p += std::snprintf(p, last - p, "%.*f", prec, v);
+        }
+        // printf uses the decimal point of the C locale
+        char* dot = std::find(start, p, '.');
+        if (!json && dot != p && spec.dot != '.') {
+            *dot = spec.dot;
+            if (spec.dot == spec.sep) {
+                std::memmove(start + 1, start, p - start);
+                *start = '"';
+                p++;
+                *p++ = '"';
+            }
+        }
+    }
+    if (json) {
+        *p++ = '}';
+    }
+    *p++ = '\n';
+    return p;
+}
+
+// Serializes all records with @a spec, returns the end of the output
+char* serialize_rows(std::vector<char>& out, const RowSpec& spec,
+                     const double* vals)
+{
+    // enough for a row of %.6f values of 1e308
+    const std::size_t max_row = ROW_COLS * 340 + 80;
+    std::size_t pos = 0;
+    for (unsigned r = 0; r < ROWS_COUNT; ++r) {
+        if (out.size() - pos < max_row) {
+            out.resize(std::max(2 * out.size(), pos + max_row));
+        }
+        char* first = out.data() + pos;
+        char* last = out.data() + out.size();
+#if TEST_LIBC
+        char* end = libc_row(first, last, spec, vals + r * ROW_COLS);
+#else
+        char* end = print_float10_row(first, last, spec, g_row_cols,
+                                      vals + r * ROW_COLS, ROW_COLS);
+#endif
+        if (end == NULL) {
+            return NULL;
+        }
+        pos = end - out.data();
+    }
+    return out.data() + pos;
+}
+
+#if TEST_CMP
+// Checks -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+bool is_json_number(const std::string& s)
+{
+    const char* p = s.c_str();
+    if (*p == '-') p++;
+    if (*p == '0') {
+        p++;
+    } else if (*p >= '1' && *p <= '9') {
+        while (std::isdigit(*p)) p++;
+    } else {
+        return false;
+    }
+    if (*p == '.') {
+        p++;
+        if (!std::isdigit(*p)) return false;
+        while (std::isdigit(*p)) p++;
+    }
+    if (*p == 'e' || *p == 'E') {
+        p++;
+        if (*p == '+' || *p == '-') p++;
+        if (!std::isdigit(*p)) return false;
+        while (std::isdigit(*p)) p++;
+    }
+    return *p == '\0';
+}
+
+// Splits a row into its fields, the JSON braces are removed
+std::vector<std::string> split_row(const std::string& row, const RowSpec& spec)
+{
+    std::string s = row;
+    char sep = spec.sep;
+    if (spec.format == ROW_JSON) {
+        s = s.substr(1, s.size() - 2);
+        sep = ',';
+    }
+    std::vector<std::string> fields(1);
+    bool quoted = false;
+    for (char ch : s) {
+        if (ch == '"' && spec.format == ROW_CSV) {
+            quoted = !quoted;
+        } else if (ch == sep && !quoted) {
+            fields.push_back(std::string());
+            continue;
+        }
+        fields.back() += ch;
+    }
+    return fields;
+}
+
+// Parses a shortest field of libc_row or print_float10_row
+double parse_row_field(std::string s, const RowSpec& spec)
+{
+    if (spec.format == ROW_JSON) {
+        s = s.substr(s.find(':') + 1);
+    } else if (!s.empty() && s[0] == '"') {
+        s = s.substr(1, s.size() - 2);
+    }
+    std::replace(s.begin(), s.end(), spec.format == ROW_JSON ? '.' : spec.dot, '.');
+    return std::strtod(s.c_str(), NULL);
+}
+
+bool check_row(const std::string& a, const std::string& b, const RowSpec& spec,
+               const double* vals)
+{
+    std::vector<std::string> fa = split_row(a, spec);
+    std::vector<std::string> fb = split_row(b, spec);
+    if (fa.size() != ROW_COLS || fb.size() != ROW_COLS) {
+        return false;
+    }
+    for (unsigned c = 0; c < ROW_COLS; ++c) {
+        if (spec.format == ROW_JSON) {
+            std::string num = fb[c].substr(fb[c].find(':') + 1);
+            if (std::isfinite(vals[c]) && !is_json_number(num)) {
+                return false;
+            }
+            if (fa[c].substr(0, fa[c].find(':')) != fb[c].substr(0, fb[c].find(':'))) {
+                return false;
+            }
+        }
+        if (g_row_cols[c].prec >= 0 || !std::isfinite(vals[c])) {
+            if (fa[c] != fb[c]) {
+                return false;
+            }
+        } else if (parse_row_field(fb[c], spec) != vals[c] ||
+                   fb[c].size() > fa[c].size()) {
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
+int test_rows()
+{
+    std::vector<double> vals(ROWS_COUNT * ROW_COLS);
+    for (unsigned i = 0; i < vals.size(); ++i) {
+        vals[i] = row_value(i % ROW_COLS);
+    }
+#if TEST_CMP
+    unsigned long long succ = 0;
+    unsigned long long fail = 0;
+    for (const RowSpec& spec : g_row_specs) {
+        std::vector<char> a(ROWS_COUNT * 256), b(ROWS_COUNT * 256);
+        char* a_end = NULL;
+        char* b_end = NULL;
+        for (unsigned r = 0; r < ROWS_COUNT; ++r) {
+            const double* row = vals.data() + r * ROW_COLS;
+            char row_a[4096], row_b[4096];
+            a_end = libc_row(row_a, row_a + sizeof(row_a), spec, row);
+            b_end = print_float10_row(row_b, row_b + sizeof(row_b), spec,
+                                      g_row_cols, row, ROW_COLS);
+            // without the newline
+            std::string sa(row_a, a_end - 1);
+            std::string sb = b_end ? std::string(row_b, b_end - 1) : "(overflow)";
+            if (b_end != NULL && check_row(sa, sb, spec, row)) {
+                succ++;
+            } else {
+                std::cout << sa << "\n" << sb << "\n";
+                fail++;
+            }
+
+            bool finite = std::all_of(row, row + ROW_COLS,
+                                      [](double v) { return std::isfinite(v); });
+            RowSpec err_spec = spec;
+            err_spec.nonfinite = NONFINITE_ERROR;
+            char* err_end = print_float10_row(row_b, row_b + sizeof(row_b),
+                                              err_spec, g_row_cols, row, ROW_COLS);
+            if ((err_end != NULL) == finite) {
+                succ++;
+            } else {
+                std::cout << "NONFINITE_ERROR: " << sb << "\n";
+                fail++;
+            }
+        }
+    }
+
+    // key escaping and a too small buffer
+    RowColumn esc_col = { "a\"b\\c\n", -1 };
+    double one = 1;
+    char buf[64];
+    char* end = print_float10_row(buf, buf + sizeof(buf), g_row_specs[0],
+                                  &esc_col, &one, 1);
+    if (end && std::string(buf, end) == "{\"a\\\"b\\\\c\\u000a\":1}\n") {
+        succ++;
+    } else {
+        std::cout << "key escaping: " << (end ? std::string(buf, end) : "NULL") << "\n";
+        fail++;
+    }
+    if (print_float10_row(buf, buf + 10, g_row_specs[0], &esc_col, &one, 1) == NULL) {
+        succ++;
+    } else {
+        std::cout << "overflow not detected\n";
+        fail++;
+    }
+    std::cout << "Fail: " << fail << "\n"
+              << "Success: " << succ << "\n";
+#else
+    for (const RowSpec& spec : g_row_specs) {
+        std::vector<char> out(ROWS_COUNT * 64);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        char* end = serialize_rows(out, spec, vals.data());
+        double time = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - start).count();
+        if (end == NULL) {
+            std::cerr << "serialization failed\n";
+            return 1;
+        }
+        std::cout.write(out.data(), end - out.data());
+        std::cerr << (spec.format == ROW_JSON ? "JSON" : "CSV") << " rows: "
+                  << ROWS_COUNT / time << " rows/s\n";
+    }
+#endif
+    return 0;
+}
+#endif
+
+#if TEST_CMP_TOCHARS
+/// Compares the shortest and the fixed-precision scientific outputs
+void cmp_tochars(T val, unsigned long long& succ, unsigned long long& fail)
+{
+    char buf_std[1024];
+    char buf_cf[1024];
+    for (unsigned j = 0; j < 2; ++j) {
+        std::to_chars_result rs;
+        cf::to_chars_result rc;
+        if (j == 0) {
+            rs = std::to_chars(buf_std, buf_std + 1024, val);
+            rc = cf::to_chars(buf_cf, buf_cf + 1024, val);
+        } else {
+            rs = std::to_chars(buf_std, buf_std + 1024, val,
+                               std::chars_format::scientific, 17);
+            rc = cf::to_chars(buf_cf, buf_cf + 1024, val,
+                              std::chars_format::scientific, 17);
+        }
+        std::string a(buf_std, rs.ptr);
+        std::string b(buf_cf, rc.ptr);
+        if (a == b) {
+            succ++;
+        } else {
+            std::cout << a << "\n" << b << "\n";
+            fail++;
+        }
+    }
+}
+#endif
+
 int main()
 {
     // Ensure that the same buffer size is used in all cases
@@ -69,23 +888,144 @@ int main()
     fmt.grouplen = 0;
     fmt.sep = '\'';
 
-    unsigned flags = FLAG_FLT_EXP;
+#if TEST_CF_WIDE
+    BasicFmtInfo<WideChar> wfmt;
+    wfmt.dot = '.';
+    wfmt.groups = NULL;
+    wfmt.grouplen = 0;
+    wfmt.sep = '\'';
+#endif
+
+    char test_fmt[16];
+    if (TEST_PREC < 0) {
+        std::snprintf(test_fmt, sizeof(test_fmt), "%%%c", TEST_CONV);
+    } else {
+        std::snprintf(test_fmt, sizeof(test_fmt), "%%.%d%c", TEST_PREC, TEST_CONV);
+    }
+    char test_fmt_nl[16];
+    std::snprintf(test_fmt_nl, sizeof(test_fmt_nl), "%s\n", test_fmt);
+
+#if TEST_FP16 || TEST_BF16
+    return test_half(fmt, test_fmt, test_fmt_nl);
+#endif
+#if TEST_MATRIX
+    return test_matrix(fmt);
+#endif
+#if TEST_ROWS
+    return test_rows();
+#endif
+
+#if TEST_ZIPF
+    init_zipf_table();
+#elif TEST_PRICES
+    init_prices_table();
+#endif
+#if TEST_CF_CACHE
+    FormatCache& cache = thread_format_cache();
+#endif
+#if TEST_CF_ASYNC
+    AsyncFormatter async(std::cout);
+#endif
+
+    unsigned flags = TEST_FLAGS;
+#if TEST_CMP || TEST_CMP_TOCHARS
     unsigned long long succ = 0;
     unsigned long long fail = 0;
+#endif
     unsigned long long loop = 0;
     std::cout.setf(std::ios_base::scientific);
     std::cout.precision(17);
+#if TEST_CMP
+    // %g precisions at and beyond the 20 digits of the integer fast path
+    const T int_vals[] = { 1, 7, 10, 99, 12345, 1e15, 9007199254740992.0, 1e19 };
+    const char* int_fmts[] = { "%.19g", "%.20g", "%.25g", "%#.20g" };
+    int int_prec[] = { 19, 20, 25, 20 };
+    unsigned int_flags[] = { 0, 0, 0, FLAG_ALT };
+    for (T v : int_vals) {
+        for (unsigned j = 0; j < sizeof(int_fmts) / sizeof(*int_fmts); ++j) {
+            char buf[1024];
+            unsigned count = std::snprintf(buf, 1024, int_fmts[j], v);
+            std::ostringstream os;
+            print_float10(os, int_flags[j], -1, int_prec[j], fmt, v, int_fmts[j]);
+            if (std::string(buf, count) == os.str()) {
+                succ++;
+            } else {
+                std::cout << std::string(buf, count) << "\n" << os.str() << "\n";
+                fail++;
+            }
+        }
+    }
+#endif
+#if TEST_CMP_TOCHARS
+    // Powers of two and their neighbours. The rounding interval of a power of
+    // two is asymmetric, which the default sequence does not reach
+    typedef std::numeric_limits<T> Lim;
+    for (int e = Lim::min_exponent - Lim::digits; e < Lim::max_exponent; ++e) {
+        T p = std::ldexp(T(1), e);
+        cmp_tochars(p, succ, fail);
+        cmp_tochars(-p, succ, fail);
+        cmp_tochars(std::nextafter(p, T(0)), succ, fail);
+        cmp_tochars(std::nextafter(p, Lim::infinity()), succ, fail);
+    }
+#endif
     T val = g_start;
     for (unsigned long long i = 0; i < g_test_count; ++i) {
+#if TEST_ZIPF || TEST_PRICES
+        val = g_input_table[i % INPUT_TABLE_SIZE];
+#endif
+#if TEST_LATENCY
+        unsigned long long lat_start = latency_now();
+        while (latency_now() - lat_start < g_latency_gap) {}
+        lat_start = latency_now();
+#endif
 #if TEST_LIBC
-        std::printf("%.17e\n", val);
+        std::printf(test_fmt_nl, val);
 #elif TEST_LIBC_LONG
         std::printf("%.40e\n", val);
 #elif TEST_CF
-        print_float10(std::cout, flags, -1, 17, fmt, val, "%.17e");
+#if TEST_INLINE
+        print_float10_inline(std::cout, flags, -1, TEST_PREC, fmt, val, test_fmt);
+#else
+        print_float10(std::cout, flags, -1, TEST_PREC, fmt, val, test_fmt);
+#endif
+        std::cout << '\n';
+#elif TEST_CF_WIDE
+        WideChar wbuf[1024];
+        WideChar* wend = print_float10(wbuf, wbuf + 1023, flags, -1, TEST_PREC,
+                                       wfmt, val, test_fmt);
+        *wend++ = '\n';
+        std::cout.write((const char*) wbuf, (wend - wbuf) * sizeof(WideChar));
+#elif TEST_CF_WIDEN
+        char buf[1024];
+        char* end = print_float10(buf, buf + 1023, flags, -1, TEST_PREC, fmt,
+                                  val, test_fmt);
+        *end++ = '\n';
+        WideChar wbuf[1024];
+        WideChar* wend = std::copy(buf, end, wbuf);
+        std::cout.write((const char*) wbuf, (wend - wbuf) * sizeof(WideChar));
+#elif TEST_CF_ASYNC
+        async.push(flags, -1, TEST_PREC, 0, val);
+#elif TEST_CF_CACHE
+        cache.print(std::cout, flags, -1, TEST_PREC, fmt, val, test_fmt);
         std::cout << '\n';
 #elif TEST_LIBCPP
         std::cout << val << '\n';
+#elif TEST_CF_TOCHARS
+        char buf[1024];
+        cf::to_chars_result res = cf::to_chars(buf, buf + 1024, val,
+                                               std::chars_format::scientific, 17);
+        if (res.ec == std::errc()) {
+            *res.ptr++ = '\n';
+            std::cout.write(buf, res.ptr - buf);
+        }
+#elif TEST_LIBCPP_TOCHARS
+        char buf[1024];
+        std::to_chars_result res = std::to_chars(buf, buf + 1024, val,
+                                                 std::chars_format::scientific, 17);
+        if (res.ec == std::errc()) {
+            *res.ptr++ = '\n';
+            std::cout.write(buf, res.ptr - buf);
+        }
 #elif TEST_NULL_LIBC
         std::printf("zzzzzzzzzz");
 #elif TEST_NULL_CF
@@ -98,10 +1038,14 @@ int main()
 
         for (unsigned j = 0; j < 2; ++j) {
             std::string a;
-            unsigned count = std::snprintf(buf, 1024, "%.17e", val);
+            unsigned count = std::snprintf(buf, 1024, test_fmt, val);
             a.assign(buf, count);
             std::ostringstream os;
-            print_float10(os, flags, -1, 17, fmt, val, "%.17e");
+#if TEST_INLINE
+            print_float10_inline(os, flags, -1, TEST_PREC, fmt, val, test_fmt);
+#else
+            print_float10(os, flags, -1, TEST_PREC, fmt, val, test_fmt);
+#endif
             std::string b = os.str();
             if (a == b) {
                 succ++;
@@ -119,6 +1063,16 @@ int main()
             std::cout << " -- " << i << "\n";
             std::cout.flush();
         }
+#elif TEST_CMP_TOCHARS
+        cmp_tochars(val, succ, fail);
+        if (i % (1024*1024) == 0) {
+            std::cout << " -- " << i << "\n";
+            std::cout.flush();
+        }
+#endif
+#if TEST_LATENCY
+        unsigned long long lat = latency_now() - lat_start;
+        g_latency_hist[std::min(lat, (unsigned long long) LATENCY_HIST_SIZE - 1)]++;
 #endif
         g_dummy_store = val;
         val *= g_mul;
@@ -130,7 +1084,26 @@ int main()
             val = g_min * loop * g_mul_loop;
         }
     }
-#if TEST_CMP
+#if TEST_CF_CACHE
+    const FormatCache::Stats& st = cache.stats();
+    std::cerr << "Cache hits: " << st.hits << " misses: " << st.misses
+              << " evictions: " << st.evictions
+              << " uncacheable: " << st.uncacheable << "\n";
+#endif
+#if TEST_CF_ASYNC
+    async.flush();
+    AsyncFormatter::Stats ast = async.stats();
+    std::cerr << "Async pushed: " << ast.pushed << " dropped: " << ast.dropped
+              << " batches: " << ast.batches << "\n";
+#endif
+#if TEST_LATENCY
+    print_latency_percentile("p50", 0.5);
+    print_latency_percentile("p99", 0.99);
+    print_latency_percentile("p99.9", 0.999);
+    print_latency_percentile("p99.99", 0.9999);
+    std::cerr << "\n";
+#endif
+#if TEST_CMP || TEST_CMP_TOCHARS
     std::cout << "Fail: " << fail << "\n"
               << "Success: " << succ << "\n";
 #endif